@@ -4,6 +4,12 @@
  * Command line options:
  *    -info      print GL implementation information
  *    -exit      automatically exit after 30 seconds
+ *    -stress N  draw a grid of N meshing gears
+ *    -frames N  automatically exit after N frames
+ *    -json file write frame time statistics as JSON on exit
+ *    -csv file  write per-frame times as CSV on exit
+ *    -headless N render N frames offscreen and print timings
+ *    -size WxH  offscreen framebuffer size
  *
  *
  * Brian Paul
@@ -17,13 +23,17 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 #define GL_GLEXT_PROTOTYPES
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
 #include <GL/glut.h>
 #endif
+#include "headless.h"
+#include "sim.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265
@@ -34,12 +44,96 @@ static GLint T0 = 0;
 static GLint Frames = 0;
 static GLint autoexit = 0;
 static GLint win = 0;
+static GLint maxframes = 0;
+static const char *jsonfile = NULL;
+static const char *csvfile = NULL;
 
 
 /**
 
-  Draw a gear wheel.  You'll probably want to call this function when
-  building a display list since we do a lot of trig here.
+  Gear meshes live in indexed vertex buffers with interleaved positions
+  and normals.  Each mesh is built once, the first time a gear with the
+  given parameters is asked for, and shared by every gear drawn with it.
+  Faces that were flat shaded get their own vertices so the face normal
+  is exact, and the inside cylinder shares smoothed normals.
+
+ **/
+
+typedef struct {
+  GLfloat inner_radius, outer_radius, width, tooth_depth;
+  GLint teeth;
+  GLuint vbo, ibo;      /* vertex and index buffers */
+  GLsizei nindex;       /* number of indices (triangles * 3) */
+} GearMesh;
+
+#define MAX_MESHES 8
+static GearMesh meshes[MAX_MESHES];
+static int nmeshes = 0;
+
+/* vertex and index arrays used while building a mesh */
+static GLfloat *verts = NULL;
+static GLuint *indices = NULL;
+static int nverts = 0, maxverts = 0;
+static int nindex = 0, maxindex = 0;
+
+static GLuint
+vertex(GLfloat r, GLfloat angle, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz)
+{
+  if (nverts == maxverts) {
+    maxverts = maxverts ? 2 * maxverts : 1024;
+    verts = (GLfloat *) realloc(verts, 6 * maxverts * sizeof(GLfloat));
+    if (!verts) {
+      fprintf(stderr, "Out of memory building gear\n");
+      exit(1);
+    }
+  }
+  verts[6 * nverts + 0] = r * cos(angle);
+  verts[6 * nverts + 1] = r * sin(angle);
+  verts[6 * nverts + 2] = z;
+  verts[6 * nverts + 3] = nx;
+  verts[6 * nverts + 4] = ny;
+  verts[6 * nverts + 5] = nz;
+  return nverts++;
+}
+
+static void
+triangle(GLuint a, GLuint b, GLuint c)
+{
+  if (nindex + 3 > maxindex) {
+    maxindex = maxindex ? 2 * maxindex : 3072;
+    indices = (GLuint *) realloc(indices, maxindex * sizeof(GLuint));
+    if (!indices) {
+      fprintf(stderr, "Out of memory building gear\n");
+      exit(1);
+    }
+  }
+  indices[nindex++] = a;
+  indices[nindex++] = b;
+  indices[nindex++] = c;
+}
+
+static void
+quad(GLuint a, GLuint b, GLuint c, GLuint d)
+{
+  triangle(a, b, c);
+  triangle(a, c, d);
+}
+
+/* quad facing outward with vertices on the front and back faces */
+static void
+side(GLfloat ra, GLfloat a, GLfloat rb, GLfloat b, GLfloat w,
+     GLfloat nx, GLfloat ny)
+{
+  GLuint v0 = vertex(ra, a, w, nx, ny, 0.0);
+  GLuint v1 = vertex(ra, a, -w, nx, ny, 0.0);
+  GLuint v2 = vertex(rb, b, w, nx, ny, 0.0);
+  GLuint v3 = vertex(rb, b, -w, nx, ny, 0.0);
+  quad(v0, v1, v3, v2);
+}
+
+/**
+
+  Build the mesh of a gear wheel.
  
   Input:  inner_radius - radius of hole at center
           outer_radius - radius at center of teeth
@@ -50,133 +144,440 @@ static GLint win = 0;
  **/
 
 static void
-gear(GLfloat inner_radius, GLfloat outer_radius, GLfloat width,
-  GLint teeth, GLfloat tooth_depth)
+gear(GearMesh *mesh)
 {
   GLint i;
   GLfloat r0, r1, r2;
-  GLfloat angle, da;
+  GLfloat angle, da, period, w;
   GLfloat u, v, len;
+  GLint teeth = mesh->teeth;
 
-  r0 = inner_radius;
-  r1 = outer_radius - tooth_depth / 2.0;
-  r2 = outer_radius + tooth_depth / 2.0;
-
-  da = 2.0 * M_PI / teeth / 4.0;
+  r0 = mesh->inner_radius;
+  r1 = mesh->outer_radius - mesh->tooth_depth / 2.0;
+  r2 = mesh->outer_radius + mesh->tooth_depth / 2.0;
+  w = mesh->width * 0.5;
 
-  glShadeModel(GL_FLAT);
+  period = 2.0 * M_PI / teeth;
+  da = period / 4.0;
+  nverts = nindex = 0;
 
-  glNormal3f(0.0, 0.0, 1.0);
+  for (i = 0; i < teeth; i++) {
+    angle = i * period;
+
+    /* front face and front sides of teeth */
+    quad(vertex(r1, angle, w, 0.0, 0.0, 1.0),
+         vertex(r2, angle + da, w, 0.0, 0.0, 1.0),
+         vertex(r2, angle + 2 * da, w, 0.0, 0.0, 1.0),
+         vertex(r1, angle + 3 * da, w, 0.0, 0.0, 1.0));
+    triangle(vertex(r0, angle, w, 0.0, 0.0, 1.0),
+             vertex(r1, angle, w, 0.0, 0.0, 1.0),
+             vertex(r1, angle + 3 * da, w, 0.0, 0.0, 1.0));
+    quad(vertex(r0, angle, w, 0.0, 0.0, 1.0),
+         vertex(r1, angle + 3 * da, w, 0.0, 0.0, 1.0),
+         vertex(r1, angle + period, w, 0.0, 0.0, 1.0),
+         vertex(r0, angle + period, w, 0.0, 0.0, 1.0));
+
+    /* back face and back sides of teeth */
+    quad(vertex(r1, angle + 3 * da, -w, 0.0, 0.0, -1.0),
+         vertex(r2, angle + 2 * da, -w, 0.0, 0.0, -1.0),
+         vertex(r2, angle + da, -w, 0.0, 0.0, -1.0),
+         vertex(r1, angle, -w, 0.0, 0.0, -1.0));
+    triangle(vertex(r1, angle, -w, 0.0, 0.0, -1.0),
+             vertex(r0, angle, -w, 0.0, 0.0, -1.0),
+             vertex(r1, angle + 3 * da, -w, 0.0, 0.0, -1.0));
+    quad(vertex(r1, angle + 3 * da, -w, 0.0, 0.0, -1.0),
+         vertex(r0, angle, -w, 0.0, 0.0, -1.0),
+         vertex(r0, angle + period, -w, 0.0, 0.0, -1.0),
+         vertex(r1, angle + period, -w, 0.0, 0.0, -1.0));
+
+    /* outward faces of teeth */
+    u = r2 * cos(angle + da) - r1 * cos(angle);
+    v = r2 * sin(angle + da) - r1 * sin(angle);
+    len = sqrt(u * u + v * v);
+    side(r1, angle, r2, angle + da, w, v / len, -u / len);
+    side(r2, angle + da, r2, angle + 2 * da, w, cos(angle), sin(angle));
+    u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
+    v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
+    len = sqrt(u * u + v * v);
+    side(r2, angle + 2 * da, r1, angle + 3 * da, w, v / len, -u / len);
+    side(r1, angle + 3 * da, r1, angle + period, w, cos(angle), sin(angle));
+  }
 
-  /* draw front face */
-  glBegin(GL_QUAD_STRIP);
+  /* inside radius cylinder with shared normals */
   for (i = 0; i <= teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
-    glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-    if (i < teeth) {
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
-    }
+    angle = i * period;
+    vertex(r0, angle, -w, -cos(angle), -sin(angle), 0.0);
+    vertex(r0, angle, w, -cos(angle), -sin(angle), 0.0);
+    if (i > 0)
+      quad(nverts - 4, nverts - 3, nverts - 1, nverts - 2);
   }
-  glEnd();
 
-  /* draw front sides of teeth */
-  glBegin(GL_QUADS);
-  da = 2.0 * M_PI / teeth / 4.0;
-  for (i = 0; i < teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
+  glGenBuffers(1, &mesh->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+  glBufferData(GL_ARRAY_BUFFER, 6 * nverts * sizeof(GLfloat), verts, GL_STATIC_DRAW);
+  glGenBuffers(1, &mesh->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, nindex * sizeof(GLuint), indices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mesh->nindex = nindex;
+}
 
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-    glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-    glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), width * 0.5);
-    glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
+/* find the mesh for a gear, building it the first time */
+static GearMesh *
+gear_mesh(GLfloat inner_radius, GLfloat outer_radius, GLfloat width,
+  GLint teeth, GLfloat tooth_depth)
+{
+  int i;
+  GearMesh *mesh;
+
+  for (i = 0; i < nmeshes; i++) {
+    mesh = &meshes[i];
+    if (mesh->inner_radius == inner_radius && mesh->outer_radius == outer_radius &&
+        mesh->width == width && mesh->teeth == teeth && mesh->tooth_depth == tooth_depth)
+      return mesh;
+  }
+  if (nmeshes == MAX_MESHES) {
+    fprintf(stderr, "Too many gear meshes\n");
+    exit(1);
   }
-  glEnd();
+  mesh = &meshes[nmeshes++];
+  mesh->inner_radius = inner_radius;
+  mesh->outer_radius = outer_radius;
+  mesh->width = width;
+  mesh->teeth = teeth;
+  mesh->tooth_depth = tooth_depth;
+  gear(mesh);
+  return mesh;
+}
 
-  glNormal3f(0.0, 0.0, -1.0);
+/* bind a mesh for drawing */
+static void
+bind_mesh(const GearMesh *mesh)
+{
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+  glVertexPointer(3, GL_FLOAT, 6 * sizeof(GLfloat), (void *) 0);
+  glNormalPointer(GL_FLOAT, 6 * sizeof(GLfloat), (void *) (3 * sizeof(GLfloat)));
+}
 
-  /* draw back face */
-  glBegin(GL_QUAD_STRIP);
-  for (i = 0; i <= teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-    glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-    if (i < teeth) {
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+/* draw the bound mesh */
+static void
+draw_mesh(const GearMesh *mesh)
+{
+  glDrawElements(GL_TRIANGLES, mesh->nindex, GL_UNSIGNED_INT, (void *) 0);
+}
+
+static GearMesh *gear1, *gear2, *gear3;
+static GLint stress = 0;  /* number of gears in stress mode */
+
+static GLfloat red[4] = {0.8, 0.1, 0.0, 1.0};
+static GLfloat green[4] = {0.0, 0.8, 0.2, 1.0};
+static GLfloat blue[4] = {0.2, 0.2, 1.0, 1.0};
+
+/**
+
+  The gears turn on the simulation thread of HW6/sim.c, which steps
+  SIM_HZ times a second and publishes each step as an immutable State
+  snapshot through its triple buffer, so a slow frame skips snapshots
+  and a slow step redraws the same one without either stalling the
+  other.  Key presses reach the simulation through InputPush.  Headless
+  runs step the simulation from idle() before each frame instead, so
+  every run draws the same frames.
+
+ **/
+
+#define SIM_HZ 120
+
+typedef struct {
+  GLfloat view_rotx, view_roty, view_rotz;
+  GLfloat angle;
+} State;
+
+static State sim = {20.0, 30.0, 0.0, 0.0};   /* simulation's copy */
+static State states[3];
+static triple_t scene;
+static int sim_running = 0;
+
+/* apply queued keys, turn the gears to time ms and publish */
+static int
+sim_step(int ms)
+{
+  static int t0 = -1;
+  int special, code;
+
+  while (InputPop(&special, &code)) {
+    if (!special) {
+      if (code == 'z')
+        sim.view_rotz += 5.0;
+      else if (code == 'Z')
+        sim.view_rotz -= 5.0;
     }
+    else if (code == GLUT_KEY_UP)
+      sim.view_rotx += 5.0;
+    else if (code == GLUT_KEY_DOWN)
+      sim.view_rotx -= 5.0;
+    else if (code == GLUT_KEY_LEFT)
+      sim.view_roty += 5.0;
+    else if (code == GLUT_KEY_RIGHT)
+      sim.view_roty -= 5.0;
   }
-  glEnd();
 
-  /* draw back sides of teeth */
-  glBegin(GL_QUADS);
-  da = 2.0 * M_PI / teeth / 4.0;
-  for (i = 0; i < teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
+  if (t0 < 0)
+    t0 = ms;
+  sim.angle += 70.0 * (ms - t0) / 1000.0;  /* 70 degrees per second */
+  sim.angle = fmod(sim.angle, 360.0); /* prevents eventual overflow */
+  t0 = ms;
+
+  *(State *) TripleWrite(&scene) = sim;
+  TriplePublish(&scene);
+  return 1;  /* the gears never stop */
+}
+
+/**
+
+  Frame time telemetry.
+
+  Every frame records the CPU time spent in draw(), the interval since
+  the previous frame started and, when timer queries are available, the
+  GPU time of the frame.  GPU times come from a ring of GL_TIME_ELAPSED
+  queries that are read back a few frames later so the pipeline never
+  stalls.  On exit the percentiles and a histogram are printed and the
+  samples can be written as JSON and CSV.
+
+ **/
+
+#define QUERIES 4         /* frames in flight for GPU timing */
+
+typedef struct {
+  double cpu;             /* ms spent in draw() */
+  double gpu;             /* ms of GPU work, negative until known */
+  double interval;        /* ms since the previous frame started */
+} FrameTime;
+
+static FrameTime *frame_times = NULL;
+static int nframes = 0, maxframe_times = 0;
+static int timer_queries = 0;
+static GLuint queries[QUERIES];
+static int query_frame[QUERIES];   /* frame each query belongs to, -1 if idle */
+static int primed[QUERIES];        /* query has already returned one result */
+static double frame_start = 0.0;
+
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000.0 * ts.tv_sec + 1e-6 * ts.tv_nsec;
+}
 
-    glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-    glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), -width * 0.5);
-    glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+static void
+telemetry_init(void)
+{
+  int i;
+  const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+#ifdef GL_TIME_ELAPSED
+  if (ext && (strstr(ext, "GL_ARB_timer_query") || strstr(ext, "GL_EXT_timer_query"))) {
+    glGenQueries(QUERIES, queries);
+    timer_queries = 1;
   }
-  glEnd();
+#endif
+  for (i = 0; i < QUERIES; i++) {
+    query_frame[i] = -1;
+    primed[i] = 0;
+  }
+}
 
-  /* draw outward faces of teeth */
-  glBegin(GL_QUAD_STRIP);
-  for (i = 0; i < teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
+/* read back a finished query, waiting for it if wait is set */
+static void
+read_query(int slot, int wait)
+{
+#ifdef GL_TIME_ELAPSED
+  GLuint64 ns;
+  GLint ready = 1;
+  if (query_frame[slot] < 0)
+    return;
+  if (!wait)
+    glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &ready);
+  if (ready) {
+    glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &ns);
+    /* the first result of a query object is thrown away, since
+       llvmpipe reports a raw timestamp for it */
+    if (primed[slot])
+      frame_times[query_frame[slot]].gpu = 1e-6 * ns;
+    primed[slot] = 1;
+    query_frame[slot] = -1;
+  }
+#endif
+}
 
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-    glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-    u = r2 * cos(angle + da) - r1 * cos(angle);
-    v = r2 * sin(angle + da) - r1 * sin(angle);
-    len = sqrt(u * u + v * v);
-    u /= len;
-    v /= len;
-    glNormal3f(v, -u, 0.0);
-    glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-    glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-    glNormal3f(cos(angle), sin(angle), 0.0);
-    glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), width * 0.5);
-    glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), -width * 0.5);
-    u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
-    v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
-    glNormal3f(v, -u, 0.0);
-    glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
-    glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-    glNormal3f(cos(angle), sin(angle), 0.0);
+static void
+frame_begin(void)
+{
+  double t = now_ms();
+  int slot = nframes % QUERIES;
+
+  if (nframes == maxframe_times) {
+    maxframe_times = maxframe_times ? 2 * maxframe_times : 4096;
+    frame_times = (FrameTime *) realloc(frame_times, maxframe_times * sizeof(FrameTime));
+    if (!frame_times) {
+      fprintf(stderr, "Out of memory recording frame times\n");
+      exit(1);
+    }
+  }
+  frame_times[nframes].cpu = 0.0;
+  frame_times[nframes].gpu = -1.0;
+  frame_times[nframes].interval = nframes ? t - frame_start : 0.0;
+  frame_start = t;
+#ifdef GL_TIME_ELAPSED
+  if (timer_queries) {
+    /* pick up earlier results that are ready, then reuse this slot */
+    int i;
+    for (i = 0; i < QUERIES; i++)
+      if (i != slot)
+        read_query(i, 0);
+    read_query(slot, 1);
+    glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+    query_frame[slot] = nframes;
   }
+#endif
+}
 
-  glVertex3f(r1 * cos(0), r1 * sin(0), width * 0.5);
-  glVertex3f(r1 * cos(0), r1 * sin(0), -width * 0.5);
+static void
+frame_end(void)
+{
+#ifdef GL_TIME_ELAPSED
+  if (timer_queries)
+    glEndQuery(GL_TIME_ELAPSED);
+#endif
+  frame_times[nframes++].cpu = now_ms() - frame_start;
+}
 
-  glEnd();
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
 
-  glShadeModel(GL_SMOOTH);
+typedef struct {
+  int n;
+  double mean, p50, p95, p99, max;
+} FrameStats;
 
-  /* draw inside radius cylinder */
-  glBegin(GL_QUAD_STRIP);
-  for (i = 0; i <= teeth; i++) {
-    angle = i * 2.0 * M_PI / teeth;
-    glNormal3f(-cos(angle), -sin(angle), 0.0);
-    glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-    glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+/* statistics of one field of the frame records, skipping negative values */
+static FrameStats
+frame_stats(size_t offset, int first)
+{
+  FrameStats st;
+  int i, n = 0;
+  double sum = 0.0;
+  double *v = (double *) malloc((nframes + 1) * sizeof(double));
+
+  memset(&st, 0, sizeof(st));
+  if (!v)
+    return st;
+  for (i = first; i < nframes; i++) {
+    double x = *(double *) ((char *) &frame_times[i] + offset);
+    if (x >= 0.0) {
+      v[n++] = x;
+      sum += x;
+    }
   }
-  glEnd();
-
+  if (n > 0) {
+    qsort(v, n, sizeof(double), compare_double);
+    st.n = n;
+    st.mean = sum / n;
+    st.p50 = v[(int) ceil(0.50 * n) - 1];
+    st.p95 = v[(int) ceil(0.95 * n) - 1];
+    st.p99 = v[(int) ceil(0.99 * n) - 1];
+    st.max = v[n - 1];
+  }
+  free(v);
+  return st;
 }
 
-static GLfloat view_rotx = 20.0, view_roty = 30.0, view_rotz = 0.0;
-static GLint gear1, gear2, gear3;
-static GLfloat angle = 0.0;
+/* upper bounds of the frame interval histogram buckets in ms */
+#define BUCKETS 9
+static const double bucket_ms[BUCKETS - 1] = {1, 2, 4, 8, 16.7, 33.3, 66.7, 100};
+
+static void
+telemetry_report(void)
+{
+  static const char *names[3] = {"cpu_ms", "gpu_ms", "interval_ms"};
+  FrameStats st[3];
+  int count[BUCKETS] = {0};
+  int i, k, peak = 1;
+  FILE *f;
+
+  if (nframes == 0)
+    return;
+  /* wait for the outstanding GPU timings */
+  for (i = 0; i < QUERIES; i++)
+    read_query(i, 1);
+  st[0] = frame_stats(offsetof(FrameTime, cpu), 0);
+  st[1] = frame_stats(offsetof(FrameTime, gpu), 0);
+  st[2] = frame_stats(offsetof(FrameTime, interval), 1);
+  for (i = 1; i < nframes; i++) {
+    for (k = 0; k < BUCKETS - 1 && frame_times[i].interval > bucket_ms[k]; k++);
+    if (++count[k] > peak)
+      peak = count[k];
+  }
+
+  printf("%d frames\n", nframes);
+  printf("%-12s %9s %9s %9s %9s %9s\n", "", "mean", "p50", "p95", "p99", "max");
+  for (k = 0; k < 3; k++)
+    if (st[k].n)
+      printf("%-12s %9.3f %9.3f %9.3f %9.3f %9.3f\n", names[k],
+             st[k].mean, st[k].p50, st[k].p95, st[k].p99, st[k].max);
+  printf("Frame interval histogram (ms)\n");
+  for (k = 0; k < BUCKETS; k++) {
+    if (k < BUCKETS - 1)
+      printf(" <= %5.1f %7d ", bucket_ms[k], count[k]);
+    else
+      printf("  > %5.1f %7d ", bucket_ms[k - 1], count[k]);
+    for (i = 0; i < 50 * count[k] / peak; i++)
+      putchar('#');
+    putchar('\n');
+  }
+
+  if (jsonfile && (f = fopen(jsonfile, "w"))) {
+    fprintf(f, "{\n  \"frames\": %d,\n  \"renderer\": \"%s\",\n", nframes,
+            (const char *) glGetString(GL_RENDERER));
+    for (k = 0; k < 3; k++)
+      fprintf(f, "  \"%s\": {\"n\": %d, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+              names[k], st[k].n, st[k].mean, st[k].p50, st[k].p95, st[k].p99, st[k].max);
+    fprintf(f, "  \"interval_histogram\": [");
+    for (k = 0; k < BUCKETS - 1; k++)
+      fprintf(f, "{\"le_ms\": %g, \"count\": %d}, ", bucket_ms[k], count[k]);
+    fprintf(f, "{\"le_ms\": null, \"count\": %d}]\n}\n", count[BUCKETS - 1]);
+    fclose(f);
+  }
+  if (csvfile && (f = fopen(csvfile, "w"))) {
+    fprintf(f, "frame,cpu_ms,gpu_ms,interval_ms\n");
+    for (i = 0; i < nframes; i++) {
+      fprintf(f, "%d,%.4f,", i, frame_times[i].cpu);
+      if (frame_times[i].gpu >= 0.0)
+        fprintf(f, "%.4f", frame_times[i].gpu);
+      fprintf(f, ",%.4f\n", frame_times[i].interval);
+    }
+    fclose(f);
+  }
+  nframes = 0;
+}
 
 static void
 cleanup(void)
 {
-   glDeleteLists(gear1, 1);
-   glDeleteLists(gear2, 1);
-   glDeleteLists(gear3, 1);
+   int i;
+   SimStop();
+   telemetry_report();
+   for (i = 0; i < nmeshes; i++) {
+      glDeleteBuffers(1, &meshes[i].vbo);
+      glDeleteBuffers(1, &meshes[i].ibo);
+   }
+   free(verts);
+   free(indices);
    glutDestroyWindow(win);
 }
 
@@ -197,35 +598,89 @@ Print(const char* format , ...)
       glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18,*ch++);
 }
 
+/**
+
+  Stress mode fills a square grid with copies of the green gear.
+  Neighbours turn in opposite directions and are offset by the phase
+  that puts a tooth of one into the gap of the other, so the whole
+  grid meshes.  Every gear shares one bound mesh and only its matrix
+  and material change between draws.
+
+ **/
+
+static void
+draw_stress(GLfloat angle)
+{
+  int i, j, k = 0;
+  int n = (int) ceil(sqrt(stress));
+  GLfloat spacing = 2.0 * gear2->outer_radius + 0.1;
+  GLfloat period = 360.0 / gear2->teeth;
+  GLfloat phase = fmod(180.0 - 1.25 * period, period);
+  GLfloat scale = 14.0 / (n * spacing);
+  GLfloat *colors[3] = {red, green, blue};
+
+  glScalef(scale, scale, scale);
+  glTranslatef(-0.5 * (n - 1) * spacing, -0.5 * (n - 1) * spacing, 0.0);
+  bind_mesh(gear2);
+  for (j = 0; j < n && k < stress; j++)
+    for (i = 0; i < n && k < stress; i++, k++) {
+      int odd = (i + j) & 1;
+      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, colors[(i + j) % 3]);
+      glPushMatrix();
+        glTranslatef(i * spacing, j * spacing, 0.0);
+        glRotatef(odd ? phase - angle : angle, 0.0, 0.0, 1.0);
+        draw_mesh(gear2);
+      glPopMatrix();
+    }
+}
+
 static void
 draw(void)
 {
+  const State *s = TripleRead(&scene);
+  frame_begin();
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
   glPushMatrix();
-    glRotatef(view_rotx, 1.0, 0.0, 0.0);
-    glRotatef(view_roty, 0.0, 1.0, 0.0);
-    glRotatef(view_rotz, 0.0, 0.0, 1.0);
+    glRotatef(s->view_rotx, 1.0, 0.0, 0.0);
+    glRotatef(s->view_roty, 0.0, 1.0, 0.0);
+    glRotatef(s->view_rotz, 0.0, 0.0, 1.0);
 
+  if (stress)
+    draw_stress(s->angle);
+  else {
     glPushMatrix();
       glTranslatef(-3.0, -2.0, 0.0);
-      glRotatef(angle, 0.0, 0.0, 1.0);
-      glCallList(gear1);
+      glRotatef(s->angle, 0.0, 0.0, 1.0);
+      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, red);
+      bind_mesh(gear1);
+      draw_mesh(gear1);
     glPopMatrix();
 
     glPushMatrix();
       glTranslatef(3.1, -2.0, 0.0);
-      glRotatef(-2.0 * angle - 9.0, 0.0, 0.0, 1.0);
-      glCallList(gear2);
+      glRotatef(-2.0 * s->angle - 9.0, 0.0, 0.0, 1.0);
+      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, green);
+      bind_mesh(gear2);
+      draw_mesh(gear2);
     glPopMatrix();
 
     glPushMatrix();
       glTranslatef(-3.1, 4.2, 0.0);
-      glRotatef(-2.0 * angle - 25.0, 0.0, 0.0, 1.0);
-      glCallList(gear3);
+      glRotatef(-2.0 * s->angle - 25.0, 0.0, 0.0, 1.0);
+      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, blue);
+      bind_mesh(gear3);
+      draw_mesh(gear3);
     glPopMatrix();
+  }
 
   glPopMatrix();
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
   Frames++;
 
@@ -246,25 +701,25 @@ draw(void)
 
   glColor3f(1,1,1);
   glWindowPos2i(5,5);
-  if (fps>0) Print("FPS %.3f", fps);
+  if (fps>0 && stress) Print("FPS %.3f Gears %d", fps, stress);
+  else if (fps>0) Print("FPS %.3f", fps);
 
+  frame_end();
   glutSwapBuffers();
+
+  if (maxframes && nframes >= maxframes) {
+    cleanup();
+    exit(0);
+  }
 }
 
 
 static void
 idle(void)
 {
-  static double t0 = -1.;
-  double dt, t = glutGet(GLUT_ELAPSED_TIME) / 1000.0;
-  if (t0 < 0.0)
-    t0 = t;
-  dt = t - t0;
-  t0 = t;
-
-  angle += 70.0 * dt;  /* 70 degrees per second */
-  angle = fmod(angle, 360.0); /* prevents eventual overflow */
-
+  /* headless runs step the simulation here, in step with the frames */
+  if (!sim_running)
+    sim_step(SimTime());
   glutPostRedisplay();
 }
 
@@ -275,10 +730,8 @@ key(unsigned char k, int x, int y)
 {
   switch (k) {
   case 'z':
-    view_rotz += 5.0;
-    break;
   case 'Z':
-    view_rotz -= 5.0;
+    InputPush(0, k);
     break;
   case 27:  /* Escape */
     cleanup();
@@ -287,7 +740,6 @@ key(unsigned char k, int x, int y)
   default:
     return;
   }
-  glutPostRedisplay();
 }
 
 /* change view angle */
@@ -297,21 +749,14 @@ special(int k, int x, int y)
 {
   switch (k) {
   case GLUT_KEY_UP:
-    view_rotx += 5.0;
-    break;
   case GLUT_KEY_DOWN:
-    view_rotx -= 5.0;
-    break;
   case GLUT_KEY_LEFT:
-    view_roty += 5.0;
-    break;
   case GLUT_KEY_RIGHT:
-    view_roty -= 5.0;
+    InputPush(1, k);
     break;
   default:
     return;
   }
-  glutPostRedisplay();
 }
 
 /* new window size or exposure */
@@ -333,9 +778,6 @@ static void
 init(int argc, char *argv[])
 {
   static GLfloat pos[4] = {5.0, 5.0, 10.0, 0.0};
-  static GLfloat red[4] = {0.8, 0.1, 0.0, 1.0};
-  static GLfloat green[4] = {0.0, 0.8, 0.2, 1.0};
-  static GLfloat blue[4] = {0.2, 0.2, 1.0, 1.0};
   GLint i;
 
   glLightfv(GL_LIGHT0, GL_POSITION, pos);
@@ -345,25 +787,12 @@ init(int argc, char *argv[])
   glEnable(GL_DEPTH_TEST);
 
   /* make the gears */
-  gear1 = glGenLists(1);
-  glNewList(gear1, GL_COMPILE);
-  glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, red);
-  gear(1.0, 4.0, 1.0, 20, 0.7);
-  glEndList();
-
-  gear2 = glGenLists(1);
-  glNewList(gear2, GL_COMPILE);
-  glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, green);
-  gear(0.5, 2.0, 2.0, 10, 0.7);
-  glEndList();
-
-  gear3 = glGenLists(1);
-  glNewList(gear3, GL_COMPILE);
-  glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, blue);
-  gear(1.3, 2.0, 0.5, 10, 0.7);
-  glEndList();
+  gear1 = gear_mesh(1.0, 4.0, 1.0, 20, 0.7);
+  gear2 = gear_mesh(0.5, 2.0, 2.0, 10, 0.7);
+  gear3 = gear_mesh(1.3, 2.0, 0.5, 10, 0.7);
 
   glEnable(GL_NORMALIZE);
+  telemetry_init();
 
   for ( i=1; i<argc; i++ ) {
     if (strcmp(argv[i], "-info")==0) {
@@ -376,6 +805,18 @@ init(int argc, char *argv[])
       autoexit = 30;
       printf("Auto Exit after %i seconds.\n", autoexit );
     }
+    else if (strcmp(argv[i], "-frames")==0 && i+1<argc) {
+      maxframes = atoi(argv[++i]);
+      printf("Auto Exit after %i frames.\n", maxframes );
+    }
+    else if (strcmp(argv[i], "-json")==0 && i+1<argc)
+      jsonfile = argv[++i];
+    else if (strcmp(argv[i], "-csv")==0 && i+1<argc)
+      csvfile = argv[++i];
+    else if (strcmp(argv[i], "-stress")==0 && i+1<argc) {
+      stress = atoi(argv[++i]);
+      printf("Stress mode with %i gears.\n", stress );
+    }
   }
 }
 
@@ -390,6 +831,14 @@ visible(int vis)
 
 int main(int argc, char *argv[])
 {
+  TripleInit(&scene, &states[0], &states[1], &states[2]);
+  states[2] = sim;
+  if (Headless(&argc, argv)) {
+    init(argc, argv);
+    HeadlessRun(draw, reshape, idle);
+    cleanup();
+    return 0;
+  }
   glutInit(&argc, argv);
   glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
 
@@ -403,6 +852,8 @@ int main(int argc, char *argv[])
   glutKeyboardFunc(key);
   glutSpecialFunc(special);
   glutVisibilityFunc(visible);
+  sim_running = 1;
+  SimStart(sim_step, SIM_HZ);
 
   glutMainLoop();
   return 0;             /* ANSI C requires main to return int. */
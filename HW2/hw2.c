@@ -7,14 +7,35 @@
  *  s, b, r Increase the s, b, r parameter of the Lorenz Attractor
  *  d, n, t Decrease the s, b, r parameter of the Lorenz Attractor
  *  +/-    Increase/decrease size of Lorenz Attractor plotted
+ *  m      Cycle full trajectory/live comet tail/density splat
+ *  <>     Halve/double points accumulated in density mode
+ *  l      Toggle polyline simplification of the full trajectory
+ *  w      Write the full trajectory to lorenz.bin
  *  arrows Change view angle
  *  0      Reset view angle
  *  ESC || q   Exit
+ *
+ *  Command line:
+ *  hw2 file.bin             Replay a recorded trajectory
+ *  hw2 -mode M              Start in mode M (0 full, 1 live, 2 density)
+ *  hw2 -lod P               Simplify to P pixels (0 draws every point)
+ *  hw2 -export file.bin n   Record n steps to file.bin and exit
+ *  hw2 -headless N          Render N frames offscreen and print timings
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 //  OpenGL with prototypes for glext
 #define GL_GLEXT_PROTOTYPES
 #ifdef __APPLE__
@@ -22,6 +43,7 @@
 #else
 #include <GL/glut.h>
 #endif
+#include "headless.h"
 
 //  Globals
 int th = 0;       // Azimuth of view angle
@@ -39,6 +61,45 @@ double b  = 2.6666;
 double r  = 28;
 
 double lorenzPoints[50000][3]; // data structure to store Lorenz Attractor points
+int lorenzKeep[50000];  // indices of points that survive simplification
+int numKeep = 0;        // number of points drawn
+int lod = 1;            // simplify the full trajectory
+int lorenzDirty = 1;    // trajectory needs recomputing
+double lodPixels = 0.5; // allowed deviation in pixels
+
+int mode = 0; // 0 = full trajectory, 1 = live comet tail, 2 = density splat, 3 = replay
+int winWidth = 500;  // Window width in pixels
+int winHeight = 500; // Window height in pixels
+
+/*
+ *  Live comet tail
+ *
+ *  The integration keeps running and each frame appends STEPS new points
+ *  to a ring of slots in client memory.  Slot 0 holds a copy of the last
+ *  slot so the strip stays connected when the ring wraps.  When the driver
+ *  supports it the vertex buffer holds three copies of the ring, mapped
+ *  persistently.  Each frame brings the next copy up to date and draws
+ *  from it, so the CPU only waits on the fence of a copy the GPU drew two
+ *  frames ago.  Otherwise new points are uploaded with glBufferSubData.
+ */
+#define TAIL  20000    // Points in the comet tail
+#define RING  (TAIL+1) // Ring slots (slot 0 bridges the wrap)
+#define STEPS 2000     // Integration steps per frame
+#define REGIONS 3      // Copies of the ring in a mapped buffer
+unsigned int ringBuf = 0;  // Ring vertex buffer
+unsigned int fadeBuf = 0;  // Fading color ramp
+float* ring = NULL;        // Ring in client memory
+float* mapped = NULL;      // Persistently mapped buffer (or NULL)
+int persistent = 0;        // Ring is persistently mapped
+int region = 0;            // Copy of the ring drawn this frame
+int regionHead[REGIONS];   // Head when each copy was last brought up to date
+int head = 1;              // Next slot to write
+int wrapped = 0;           // Ring has wrapped at least once
+long liveSteps = 0;        // Steps integrated in live mode
+double liveX = 1, liveY = 1, liveZ = 1; // Current point of live integration
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+GLsync ringFence[REGIONS]; // Signals when the GPU is done with each copy
+#endif
 
 /*
  *  Convenience routine to output raster text
@@ -92,13 +153,651 @@ void computeLorenz(){
    }
 }
 
+/*
+ *  Squared distance from point p to the segment from a to c
+ */
+double segmentDistance2(const double p[3], const double a[3], const double c[3])
+{
+   double ac[3], ap[3];
+   double len2 = 0, t = 0, d2 = 0;
+   int k;
+   for (k = 0; k < 3; k++) {
+      ac[k] = c[k] - a[k];
+      ap[k] = p[k] - a[k];
+      len2 += ac[k] * ac[k];
+      t += ac[k] * ap[k];
+   }
+   t = len2 > 0 ? t / len2 : 0;
+   if (t < 0) t = 0;
+   if (t > 1) t = 1;
+   for (k = 0; k < 3; k++) {
+      double d = ap[k] - t * ac[k];
+      d2 += d * d;
+   }
+   return d2;
+}
+
+/*
+ *  Simplify the trajectory with Douglas-Peucker
+ *
+ *  The tolerance is lodPixels converted to world units for the current
+ *  orthogonal box and window height.  Distances are measured in 3D, which
+ *  is never less than the distance on screen, so the result is valid for
+ *  every view angle and only depends on zoom.
+ */
+void simplifyLorenz()
+{
+   static int stack[2 * 50000];
+   static char keep[50000];
+   int top = 0;
+   int i;
+   double eps = lodPixels * 2 * dim / winHeight;
+   double eps2 = eps * eps;
+
+   memset(keep, 0, numSteps);
+   keep[0] = keep[numSteps - 1] = 1;
+   stack[top++] = 0;
+   stack[top++] = numSteps - 1;
+   while (top > 0) {
+      int last = stack[--top];
+      int first = stack[--top];
+      int worst = -1;
+      double max2 = eps2;
+      // Find the point farthest from the chord
+      for (i = first + 1; i < last; i++) {
+         double d2 = segmentDistance2(lorenzPoints[i], lorenzPoints[first], lorenzPoints[last]);
+         if (d2 > max2) {
+            max2 = d2;
+            worst = i;
+         }
+      }
+      // Keep it and refine both halves
+      if (worst >= 0) {
+         keep[worst] = 1;
+         stack[top++] = first;
+         stack[top++] = worst;
+         stack[top++] = worst;
+         stack[top++] = last;
+      }
+   }
+   numKeep = 0;
+   for (i = 0; i < numSteps; i++)
+      if (keep[i])
+         lorenzKeep[numKeep++] = i;
+}
+
+/*
+ *  Map t in [0,1] to a color from black through red to yellow
+ */
+void colorRamp(float t, float rgb[3])
+{
+   rgb[0] = t;
+   rgb[1] = t * t;
+   rgb[2] = 0.3 * t * (1 - t);
+}
+
+/*
+ *  Does the driver have sync objects (OpenGL 3.2 or ARB_sync)
+ */
+int haveSync()
+{
+   int major = 0, minor = 0;
+   const char* ver = (const char*)glGetString(GL_VERSION);
+   const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+   if (ver && sscanf(ver, "%d.%d", &major, &minor) == 2 &&
+       (major > 3 || (major == 3 && minor >= 2)))
+      return 1;
+   return ext && strstr(ext, "GL_ARB_sync");
+}
+
+/*
+ *  Create the ring and color ramp buffers for live mode
+ */
+void initLive()
+{
+   int k;
+   static float ramp[RING][3];
+   const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+
+   // Color ramp from black (oldest) to yellow (newest)
+   for (k = 0; k < RING; k++)
+      colorRamp((float)k / (RING - 1), ramp[k]);
+   glGenBuffers(1, &fadeBuf);
+   glBindBuffer(GL_ARRAY_BUFFER, fadeBuf);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(ramp), ramp, GL_STATIC_DRAW);
+
+   glGenBuffers(1, &ringBuf);
+   glBindBuffer(GL_ARRAY_BUFFER, ringBuf);
+   ring = (float*)malloc(RING * 3 * sizeof(float));
+   if (!ring) {
+      fprintf(stderr, "Cannot allocate ring buffer\n");
+      exit(1);
+   }
+#if defined(GL_MAP_PERSISTENT_BIT) && defined(GL_SYNC_GPU_COMMANDS_COMPLETE)
+   // Persistent coherent mapping needs OpenGL 4.4 or ARB_buffer_storage,
+   // and fences to know when the GPU is done with a copy
+   if (ext && strstr(ext, "GL_ARB_buffer_storage") && haveSync()) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_ARRAY_BUFFER, REGIONS * RING * 3 * sizeof(float), NULL, flags);
+      mapped = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, REGIONS * RING * 3 * sizeof(float), flags);
+      persistent = (mapped != NULL);
+      for (k = 0; k < REGIONS; k++) {
+         regionHead[k] = head;
+         ringFence[k] = 0;
+      }
+   }
+#endif
+   // Otherwise upload new points to one copy of the ring
+   if (!persistent)
+      glBufferData(GL_ARRAY_BUFFER, RING * 3 * sizeof(float), NULL, GL_STREAM_DRAW);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+ *  Copy ring slots [first,last) to the vertex buffer
+ */
+void uploadRing(int first, int last)
+{
+   if (last <= first)
+      return;
+   if (persistent)
+      memcpy(mapped + 3 * (region * RING + first), ring + 3 * first,
+             (last - first) * 3 * sizeof(float));
+   else
+      glBufferSubData(GL_ARRAY_BUFFER, first * 3 * sizeof(float),
+                      (last - first) * 3 * sizeof(float), ring + 3 * first);
+}
+
+/*
+ *  Copy the slots written since first to the vertex buffer
+ */
+void uploadSince(int first)
+{
+   // The ring wrapped in between, which also rewrote the bridge slot
+   if (head < first) {
+      uploadRing(first, RING);
+      uploadRing(0, head);
+   }
+   else
+      uploadRing(first, head);
+}
+
+/*
+ *  Advance the live integration by STEPS points
+ */
+void advanceLive()
+{
+   int i;
+   int first = head;   // First slot written this frame
+   double dt = 0.001;
+
+   if (!ring)
+      initLive();
+   for (i = 0; i < STEPS; i++) {
+      double dx = s * (liveY - liveX);
+      double dy = liveX * (r - liveZ) - liveY;
+      double dz = liveX * liveY - b * liveZ;
+      liveX += dt * dx;
+      liveY += dt * dy;
+      liveZ += dt * dz;
+
+      ring[3 * head + 0] = liveX;
+      ring[3 * head + 1] = liveY;
+      ring[3 * head + 2] = liveZ;
+      if (++head == RING) {
+         // Bridge the wrap by copying the last point into slot 0
+         memcpy(ring, ring + 3 * (RING - 1), 3 * sizeof(float));
+         head = 1;
+         wrapped = 1;
+      }
+   }
+   liveSteps += STEPS;
+
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+   // Bring the next copy up to date once the GPU is done drawing it
+   if (persistent) {
+      region = (region + 1) % REGIONS;
+      if (ringFence[region]) {
+         glClientWaitSync(ringFence[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+         glDeleteSync(ringFence[region]);
+         ringFence[region] = 0;
+      }
+      uploadSince(regionHead[region]);
+      regionHead[region] = head;
+      return;
+   }
+#endif
+   // Upload the new points
+   glBindBuffer(GL_ARRAY_BUFFER, ringBuf);
+   uploadSince(first);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+ *  Draw count ring slots starting at first with colors from the ramp
+ */
+void drawRing(int first, int count, int color)
+{
+   if (count <= 0)
+      return;
+   glBindBuffer(GL_ARRAY_BUFFER, ringBuf);
+   glVertexPointer(3, GL_FLOAT, 0, (void*)((region * RING + first) * 3 * sizeof(float)));
+   glBindBuffer(GL_ARRAY_BUFFER, fadeBuf);
+   glColorPointer(3, GL_FLOAT, 0, (void*)(color * 3 * sizeof(float)));
+   glDrawArrays(GL_LINE_STRIP, 0, count);
+}
+
+/*
+ *  Draw the last TAIL points of the live integration
+ */
+void drawLive()
+{
+   glPushMatrix();
+   glScaled(lorenzSize, lorenzSize, lorenzSize);
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glEnableClientState(GL_COLOR_ARRAY);
+   if (wrapped) {
+      // Oldest points from head to the end, then newest from the bridge
+      drawRing(head, RING - head, 0);
+      drawRing(0, head, RING - head);
+   }
+   else
+      drawRing(1, head - 1, RING - (head - 1));
+   glDisableClientState(GL_COLOR_ARRAY);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glPopMatrix();
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+   if (persistent) {
+      // Drawn again without new points: the newer fence covers both
+      if (ringFence[region])
+         glDeleteSync(ringFence[region]);
+      ringFence[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   }
+#endif
+}
+
+/*
+ *  Density splat
+ *
+ *  Instead of drawing every point, the attractor is accumulated into a
+ *  histogram with one bin per window pixel and drawn as a single textured
+ *  quad.  Each thread integrates its own trajectory from a slightly
+ *  different starting point into private bins, so no locking is needed,
+ *  and the bins are summed at the end.  The histogram is only rebuilt
+ *  when the view, parameters or window change.
+ */
+#define MAXTHREADS 16
+long densityPoints = 20000000;  // Points accumulated per rebuild
+int densityDirty = 1;           // Histogram needs rebuilding
+int densityThreads = 1;         // Threads used for the last rebuild
+double densityTime = 0;         // Seconds taken by the last rebuild
+unsigned int densityTex = 0;    // Tone mapped histogram texture
+
+typedef struct {
+   int id;               // Thread number
+   long n;               // Points to accumulate
+   double m[3][3];       // View rotation
+   unsigned int* bins;   // Private histogram
+} splat_t;
+
+/*
+ *  Integrate one trajectory and bin the projected points
+ */
+void* splatThread(void* arg)
+{
+   splat_t* job = (splat_t*)arg;
+   long i;
+   double dt = 0.001;
+   // Perturb the start so each thread follows a different trajectory
+   double x = 1 + 0.001 * job->id;
+   double y = 1;
+   double z = 1;
+   // Map the orthogonal projection box to bins
+   double w2h = (double)winWidth / winHeight;
+   double sx = winWidth / (2 * dim * w2h);
+   double sy = winHeight / (2 * dim);
+
+   for (i = 0; i < job->n; i++) {
+      double dx = s * (y - x);
+      double dy = x * (r - z) - y;
+      double dz = x * y - b * z;
+      x += dt * dx;
+      y += dt * dy;
+      z += dt * dz;
+
+      // Rotate into view space
+      double X = lorenzSize * (job->m[0][0] * x + job->m[0][1] * y + job->m[0][2] * z);
+      double Y = lorenzSize * (job->m[1][0] * x + job->m[1][1] * y + job->m[1][2] * z);
+      double Z = lorenzSize * (job->m[2][0] * x + job->m[2][1] * y + job->m[2][2] * z);
+      int px = (int)((X + dim * w2h) * sx);
+      int py = (int)((Y + dim) * sy);
+      if (px >= 0 && px < winWidth && py >= 0 && py < winHeight && fabs(Z) <= dim)
+         job->bins[py * winWidth + px]++;
+   }
+   return NULL;
+}
+
+/*
+ *  Rebuild the density histogram and upload it as a texture
+ */
+void computeDensity()
+{
+   static splat_t jobs[MAXTHREADS];
+   static pthread_t threads[MAXTHREADS];
+   static unsigned char* image = NULL;
+   int n = winWidth * winHeight;
+   int i, k;
+   unsigned int max = 0;
+   struct timespec t0, t1;
+   double ct = cos(th * M_PI / 180), st = sin(th * M_PI / 180);
+   double cp = cos(ph * M_PI / 180), sp = sin(ph * M_PI / 180);
+   // Same rotation as glRotated(ph,1,0,0) followed by glRotated(th,0,1,0)
+   double m[3][3] = {{ct, 0, st}, {sp * st, cp, -sp * ct}, {-cp * st, sp, cp * ct}};
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   densityThreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (densityThreads < 1) densityThreads = 1;
+   if (densityThreads > MAXTHREADS) densityThreads = MAXTHREADS;
+
+   // Start one integration per thread, each with its own bins
+   for (k = 0; k < densityThreads; k++) {
+      jobs[k].id = k;
+      jobs[k].n = densityPoints / densityThreads;
+      memcpy(jobs[k].m, m, sizeof(m));
+      jobs[k].bins = (unsigned int*)realloc(jobs[k].bins, n * sizeof(unsigned int));
+      if (!jobs[k].bins) {
+         fprintf(stderr, "Cannot allocate density bins\n");
+         exit(1);
+      }
+      memset(jobs[k].bins, 0, n * sizeof(unsigned int));
+      if (k > 0 && pthread_create(&threads[k], NULL, splatThread, &jobs[k])) {
+         fprintf(stderr, "Cannot start density thread %d\n", k);
+         exit(1);
+      }
+   }
+   // The calling thread does the first share
+   splatThread(&jobs[0]);
+   for (k = 1; k < densityThreads; k++)
+      pthread_join(threads[k], NULL);
+
+   // Merge the per-thread bins
+   for (k = 1; k < densityThreads; k++)
+      for (i = 0; i < n; i++)
+         jobs[0].bins[i] += jobs[k].bins[i];
+   for (i = 0; i < n; i++)
+      if (jobs[0].bins[i] > max)
+         max = jobs[0].bins[i];
+
+   // Logarithmic tone mapping
+   image = (unsigned char*)realloc(image, 3 * n);
+   if (!image) {
+      fprintf(stderr, "Cannot allocate density image\n");
+      exit(1);
+   }
+   for (i = 0; i < n; i++) {
+      float rgb[3];
+      colorRamp(max ? log1p(jobs[0].bins[i]) / log1p(max) : 0, rgb);
+      for (k = 0; k < 3; k++)
+         image[3 * i + k] = 255 * rgb[k];
+   }
+   if (!densityTex)
+      glGenTextures(1, &densityTex);
+   glBindTexture(GL_TEXTURE_2D, densityTex);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   densityTime = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+   densityDirty = 0;
+}
+
+/*
+ *  Draw the density histogram as one quad covering the window
+ */
+void drawDensity()
+{
+   if (densityDirty)
+      computeDensity();
+   glMatrixMode(GL_PROJECTION);
+   glPushMatrix();
+   glLoadIdentity();
+   glMatrixMode(GL_MODELVIEW);
+   glPushMatrix();
+   glLoadIdentity();
+   glEnable(GL_TEXTURE_2D);
+   glBindTexture(GL_TEXTURE_2D, densityTex);
+   glColor3f(1,1,1);
+   glBegin(GL_QUADS);
+   glTexCoord2f(0,0); glVertex2f(-1,-1);
+   glTexCoord2f(1,0); glVertex2f(+1,-1);
+   glTexCoord2f(1,1); glVertex2f(+1,+1);
+   glTexCoord2f(0,1); glVertex2f(-1,+1);
+   glEnd();
+   glDisable(GL_TEXTURE_2D);
+   glPopMatrix();
+   glMatrixMode(GL_PROJECTION);
+   glPopMatrix();
+   glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ *  Recorded trajectories
+ *
+ *  A recording is a fixed header followed by count points stored as
+ *  three native floats in unscaled attractor coordinates.  Replay maps
+ *  the file and streams it into a vertex buffer straight from the
+ *  mapping, a slice per frame, so even huge files open at once and fill
+ *  in while they are being viewed.
+ */
+#define LORENZ_MAGIC   "LRNZ"
+#define LORENZ_VERSION 1
+#define LORENZ_EULER   0
+#define REPLAY_SLICE   (1<<22)  // Points uploaded per frame
+#define REPLAY_DRAW    (1<<24)  // Points per draw call
+typedef struct {
+   char     magic[4];    // LORENZ_MAGIC
+   uint32_t version;     // LORENZ_VERSION
+   uint32_t integrator;  // LORENZ_EULER
+   uint32_t pointSize;   // Bytes per point
+   uint64_t count;       // Number of points
+   double   s, b, r;     // Lorenz parameters
+   double   dt;          // Time step
+   double   start[3];    // Initial point
+} lorenzHeader_t;
+
+lorenzHeader_t replay;        // Header of the replayed file
+const float* replayPoints;    // Points in the mapped file
+uint64_t replayLoaded = 0;    // Points uploaded so far
+unsigned int replayBuf = 0;   // Vertex buffer holding the replay
+
+/*
+ *  Integrate n steps from (1,1,1) with the current parameters and write
+ *  them to file
+ */
+int exportLorenz(const char* file, uint64_t n)
+{
+   static float chunk[3 * 65536];
+   lorenzHeader_t h;
+   uint64_t i;
+   int k = 0;
+   double x = 1, y = 1, z = 1;
+   FILE* f = fopen(file, "wb");
+   if (!f) {
+      fprintf(stderr, "Cannot open %s\n", file);
+      return 1;
+   }
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, LORENZ_MAGIC, 4);
+   h.version = LORENZ_VERSION;
+   h.integrator = LORENZ_EULER;
+   h.pointSize = 3 * sizeof(float);
+   h.count = n;
+   h.s = s;
+   h.b = b;
+   h.r = r;
+   h.dt = 0.001;
+   h.start[0] = x;
+   h.start[1] = y;
+   h.start[2] = z;
+   if (fwrite(&h, sizeof(h), 1, f) != 1) {
+      fprintf(stderr, "Cannot write header to %s\n", file);
+      fclose(f);
+      return 1;
+   }
+   for (i = 0; i < n; i++) {
+      double dx = s * (y - x);
+      double dy = x * (r - z) - y;
+      double dz = x * y - b * z;
+      x += h.dt * dx;
+      y += h.dt * dy;
+      z += h.dt * dz;
+      chunk[k++] = x;
+      chunk[k++] = y;
+      chunk[k++] = z;
+      // Flush a full chunk or the tail
+      if (k == 3 * 65536 || i == n - 1) {
+         if (fwrite(chunk, sizeof(float), k, f) != (size_t)k) {
+            fprintf(stderr, "Cannot write points to %s\n", file);
+            fclose(f);
+            return 1;
+         }
+         k = 0;
+      }
+   }
+   // Buffered points are only written out when the file is closed
+   if (fclose(f)) {
+      fprintf(stderr, "Cannot write points to %s\n", file);
+      return 1;
+   }
+   printf("Wrote %llu points to %s\n", (unsigned long long)n, file);
+   return 0;
+}
+
+/*
+ *  Release a mapped (or read) recording
+ */
+void closeRecording(const char* base, size_t size)
+{
+#ifndef _WIN32
+   munmap((void*)base, size);
+#else
+   free((void*)base);
+#endif
+}
+
+/*
+ *  Map a recording and prepare its vertex buffer
+ */
+int openReplay(const char* file)
+{
+   struct stat st;
+   const char* base;
+#ifndef _WIN32
+   int fd = open(file, O_RDONLY);
+#else
+   int fd = open(file, O_RDONLY | O_BINARY);
+#endif
+   if (fd < 0) {
+      fprintf(stderr, "Cannot open recording %s\n", file);
+      return 1;
+   }
+   if (fstat(fd, &st) || st.st_size < (off_t)sizeof(lorenzHeader_t)) {
+      fprintf(stderr, "Cannot open recording %s\n", file);
+      close(fd);
+      return 1;
+   }
+#ifndef _WIN32
+   base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (base == MAP_FAILED) {
+      fprintf(stderr, "Cannot map recording %s\n", file);
+      close(fd);
+      return 1;
+   }
+   madvise((void*)base, st.st_size, MADV_SEQUENTIAL);
+#else
+   base = (const char*)malloc(st.st_size);
+   if (!base || read(fd, (void*)base, st.st_size) != st.st_size) {
+      fprintf(stderr, "Cannot read recording %s\n", file);
+      free((void*)base);
+      close(fd);
+      return 1;
+   }
+#endif
+   close(fd);
+
+   // Validate header
+   memcpy(&replay, base, sizeof(replay));
+   if (memcmp(replay.magic, LORENZ_MAGIC, 4) || replay.version != LORENZ_VERSION ||
+       replay.pointSize != 3 * sizeof(float) ||
+       replay.count > (st.st_size - sizeof(replay)) / replay.pointSize) {
+      fprintf(stderr, "%s is not a valid Lorenz recording\n", file);
+      closeRecording(base, st.st_size);
+      return 1;
+   }
+   replayPoints = (const float*)(base + sizeof(replay));
+   replayLoaded = 0;
+   return 0;
+}
+
+/*
+ *  Upload the next slice of the recording
+ */
+void uploadReplay()
+{
+   uint64_t n = replay.count - replayLoaded;
+   if (n > REPLAY_SLICE)
+      n = REPLAY_SLICE;
+   if (!replayBuf) {
+      glGenBuffers(1, &replayBuf);
+      glBindBuffer(GL_ARRAY_BUFFER, replayBuf);
+      glBufferData(GL_ARRAY_BUFFER, replay.count * replay.pointSize, NULL, GL_STATIC_DRAW);
+      if (glGetError() == GL_OUT_OF_MEMORY) {
+         fprintf(stderr, "Recording of %llu points does not fit in GPU memory\n",
+                 (unsigned long long)replay.count);
+         exit(1);
+      }
+   }
+   glBindBuffer(GL_ARRAY_BUFFER, replayBuf);
+   glBufferSubData(GL_ARRAY_BUFFER, replayLoaded * replay.pointSize,
+                   n * replay.pointSize, replayPoints + 3 * replayLoaded);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   replayLoaded += n;
+}
+
+/*
+ *  Draw the uploaded part of the recording
+ */
+void drawReplay()
+{
+   uint64_t first;
+   if (replayLoaded < replay.count)
+      uploadReplay();
+   glPushMatrix();
+   glScaled(lorenzSize, lorenzSize, lorenzSize);
+   glColor3f(1,1,0);
+   glBindBuffer(GL_ARRAY_BUFFER, replayBuf);
+   glEnableClientState(GL_VERTEX_ARRAY);
+   // Split into draws that fit in a GLsizei, overlapping by one point
+   for (first = 0; first + 1 < replayLoaded; first += REPLAY_DRAW) {
+      uint64_t n = replayLoaded - first;
+      if (n > REPLAY_DRAW + 1)
+         n = REPLAY_DRAW + 1;
+      glVertexPointer(3, GL_FLOAT, 0, (void*)(first * replay.pointSize));
+      glDrawArrays(GL_LINE_STRIP, 0, n);
+   }
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glPopMatrix();
+}
+
 /*
  *  Display the scene
  */
 void display()
 {
-   // Generate points for Lorenz Attractor
-   computeLorenz();
    // Clear the image
    glClear(GL_COLOR_BUFFER_BIT);
    // Reset previous transforms
@@ -108,14 +807,34 @@ void display()
    glRotated(th,0,1,0);
    
    // Draw Lorenz Attractor
-   glColor3f(1,1,0);
-   glPointSize(3);
-   glBegin(GL_LINE_STRIP);
-   for(int i = 0; i < numSteps; i++){
-      glColor3dv(lorenzPoints[i]);
-      glVertex3dv(lorenzPoints[i]);
+   if (mode == 3)
+      drawReplay();
+   else if (mode == 2)
+      drawDensity();
+   else if (mode == 1)
+      drawLive();
+   else {
+      // Generate points for Lorenz Attractor
+      if (lorenzDirty) {
+         computeLorenz();
+         simplifyLorenz();
+         lorenzDirty = 0;
+      }
+      glColor3f(1,1,0);
+      glPointSize(3);
+      glBegin(GL_LINE_STRIP);
+      if (lod)
+         for(int i = 0; i < numKeep; i++){
+            glColor3dv(lorenzPoints[lorenzKeep[i]]);
+            glVertex3dv(lorenzPoints[lorenzKeep[i]]);
+         }
+      else
+         for(int i = 0; i < numSteps; i++){
+            glColor3dv(lorenzPoints[i]);
+            glVertex3dv(lorenzPoints[i]);
+         }
+      glEnd();
    }
-   glEnd();
 
    // Draw axes in white
    glColor3f(1,1,1);
@@ -139,12 +858,43 @@ void display()
    // Display parameters
    glWindowPos2i(5,5);
    Print("Rx=%d Ry=%d s=%.2lf b=%lf r=%.2lf",th, ph, s, b, r);
+   if (mode == 0) {
+      glWindowPos2i(5,25);
+      Print("Vertices: %d of %d%s", lod ? numKeep : numSteps, numSteps, lod ? " (simplified)" : "");
+   }
+   else if (mode == 1) {
+      glWindowPos2i(5,25);
+      Print("Live: %ld steps%s", liveSteps, persistent ? " (mapped)" : "");
+   }
+   else if (mode == 3) {
+      glWindowPos2i(5,25);
+      Print("Replay: %llu of %llu points s=%.2f b=%f r=%.2f dt=%g",
+            (unsigned long long)replayLoaded, (unsigned long long)replay.count,
+            replay.s, replay.b, replay.r, replay.dt);
+   }
+   else if (mode == 2) {
+      glWindowPos2i(5,25);
+      Print("Density: %ld points %d threads %.0f ms", densityPoints, densityThreads, 1000 * densityTime);
+   }
 
    // Flush and swap
    glFlush();
    glutSwapBuffers();
 }
 
+/*
+ *  GLUT calls this routine when there is nothing else to do
+ */
+void idle()
+{
+   if (mode == 1)
+      advanceLive();
+   // Keep drawing until the whole recording is uploaded
+   else if (mode != 3 || replayLoaded >= replay.count)
+      glutIdleFunc(NULL);
+   glutPostRedisplay();
+}
+
 /*
  *  GLUT calls this routine when a key is pressed
  */
@@ -180,6 +930,25 @@ void key(unsigned char ch,int x,int y)
       b  = 2.6666;
       r  = 28;
    }
+   // Cycle display mode (replay only when a recording was given)
+   else if (ch == 'm') {
+      mode = (mode + 1) % (replayPoints ? 4 : 3);
+      glutIdleFunc(mode == 1 || mode == 3 ? idle : NULL);
+   }
+   // Write the full trajectory
+   else if (ch == 'w')
+      exportLorenz("lorenz.bin", numSteps);
+   // Change points accumulated in density mode
+   else if (ch == '<' && densityPoints > 1000000)
+      densityPoints /= 2;
+   else if (ch == '>' && densityPoints < 1000000000)
+      densityPoints *= 2;
+   // Toggle polyline simplification
+   else if (ch == 'l')
+      lod = 1 - lod;
+   // Any change requires a new trajectory and density histogram
+   lorenzDirty = 1;
+   densityDirty = 1;
    // Tell GLUT it is necessary to redisplay the scene
    glutPostRedisplay();
 }
@@ -206,6 +975,8 @@ void special(int key,int x,int y)
    th %= 360;
    ph %= 360;
 
+   // The density histogram depends on the view angle
+   densityDirty = 1;
    // Tell GLUT it is necessary to redisplay the scene
    glutPostRedisplay();
 }
@@ -217,6 +988,11 @@ void reshape(int width,int height)
 {
    // Ratio of the width to the height of the window
    double w2h = (height>0) ? (double)width/height : 1;
+   // Remember window size for the density histogram
+   winWidth = width > 0 ? width : 1;
+   winHeight = height > 0 ? height : 1;
+   lorenzDirty = 1;
+   densityDirty = 1;
    // Set the viewport to the entire window
    glViewport(0,0, width,height);
    // Tell OpenGL we want to manipulate the projection matrix
@@ -237,8 +1013,38 @@ void reshape(int width,int height)
  */
 int main(int argc,char* argv[])
 {
+   // Record a trajectory without opening a window
+   if (argc >= 3 && !strcmp(argv[1], "-export"))
+      return exportLorenz(argv[2], argc > 3 ? strtoull(argv[3], NULL, 10) : numSteps);
+   // Render offscreen when benchmarking
+   int headless = Headless(&argc,argv);
    // Initialize GLUT and process user parameters
-   glutInit(&argc,argv);
+   if (!headless)
+      glutInit(&argc,argv);
+   // Pick the starting mode and simplification (also with -headless)
+   int k = 1;
+   for (; k < argc - 1 && argv[k][0] == '-'; k += 2) {
+      if (!strcmp(argv[k], "-mode"))
+         mode = atoi(argv[k+1]);
+      else if (!strcmp(argv[k], "-lod"))
+         lodPixels = atof(argv[k+1]);
+      else
+         mode = -1;
+   }
+   if (mode < 0 || mode > 2 || lodPixels < 0) {
+      fprintf(stderr, "Usage: hw2 [-mode 0|1|2] [-lod pixels] [file.bin]\n");
+      return 1;
+   }
+   lod = lodPixels > 0;
+   // Replay a recorded trajectory
+   if (k < argc) {
+      if (openReplay(argv[k]))
+         return 1;
+      mode = 3;
+   }
+   // Live and replay modes advance in idle
+   if (headless)
+      return HeadlessRun(display, reshape, mode == 1 || mode == 3 ? idle : NULL);
    // Request double buffered, true color window 
    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
    // Request 500 x 500 pixel window
@@ -254,6 +1060,9 @@ int main(int argc,char* argv[])
    glutSpecialFunc(special);
    // Tell GLUT to call "key" when a key is pressed
    glutKeyboardFunc(key);
+   // Run the comet or stream the recording in while it is displayed
+   if (mode == 1 || mode == 3)
+      glutIdleFunc(idle);
    // Pass control to GLUT so it can interact with the user
    glutMainLoop();
    // Return code
@@ -20,6 +20,7 @@
 #else
 #include <GL/glut.h>
 #endif
+#include "headless.h"
 
 int th=0;         //  Azimuth of view angle
 int ph=0;         //  Elevation of view angle
@@ -420,7 +421,7 @@ void reshape(int width,int height)
 }
 
 /*
- *  GLUT calls this toutine when there is nothing else to do
+ *  GLUT calls this toutine when there is nothing else to do (headless only)
  */
 void idle()
 {
@@ -434,6 +435,9 @@ void idle()
  */
 int main(int argc,char* argv[])
 {
+   //  Render offscreen when benchmarking
+   if (Headless(&argc,argv))
+      return HeadlessRun(display,reshape,idle);
    //  Initialize GLUT and process user parameters
    glutInit(&argc,argv);
    //  Request double buffered, true color window with Z buffering at 600x600
@@ -441,8 +445,8 @@ int main(int argc,char* argv[])
    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
    //  Create the window
    glutCreateWindow("Gabriella Johnson");
-   //  Tell GLUT to call "idle" when there is nothing else to do
-   glutIdleFunc(idle);
+   //  Nothing in the scene moves, so it is only redrawn when a key is
+   //  pressed or the window needs it (idle only drives headless runs)
    //  Tell GLUT to call "display" when the scene should be drawn
    glutDisplayFunc(display);
    //  Tell GLUT to call "reshape" when the window is resized
@@ -25,6 +25,7 @@
 #else
 #include <GL/glut.h>
 #endif
+#include "headless.h"
 
 int th=0;         //  Azimuth of view angle
 int ph=0;         //  Elevation of view angle
@@ -528,6 +529,9 @@ void reshape(int width,int height)
  */
 int main(int argc,char* argv[])
 {
+   //  Render offscreen when benchmarking
+   if (Headless(&argc,argv))
+      return HeadlessRun(display,reshape,NULL);
    //  Initialize GLUT and process user parameters
    glutInit(&argc,argv);
    //  Request double buffered, true color window with Z buffering at 600x600
@@ -36,6 +36,7 @@
 #else
 #include <GL/glut.h>
 #endif
+#include "headless.h"
 
 int th=0;         //  Azimuth of view angle
 int ph=0;         //  Elevation of view angle
@@ -687,6 +688,9 @@ void reshape(int width,int height) {
  *  Start up GLUT and tell it what to do
  */
 int main(int argc,char* argv[]) {
+   //  Render offscreen when benchmarking
+   if (Headless(&argc,argv))
+      return HeadlessRun(display,reshape,idle);
    //  Initialize GLUT and process user parameters
    glutInit(&argc,argv);
    //  Request double buffered, true color window with Z buffering at 600x600
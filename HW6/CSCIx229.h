@@ -16,6 +16,10 @@
 #else
 #include <GL/glut.h>
 #endif
+//  Headless benchmark mode shared with the other assignments
+#include "headless.h"
+//  Simulation thread shared with HW1
+#include "sim.h"
 
 #define Cos(th) cos(3.1415926/180*(th))
 #define Sin(th) sin(3.1415926/180*(th))
@@ -27,14 +31,228 @@ extern "C" {
 #endif
 
 void Print(const char* format , ...);
+void PrintFlush(void);
 void Fatal(const char* format , ...);
 unsigned int LoadTexBMP(const char* file);
+void LoadTexBMPs(int n,const char* file[],unsigned int texture[]);
 void Project(double fov,double asp,double dim);
+//  OpenGL debug output (see debug.c)
+int  GLDebug(void);
+#ifdef GLDEBUG
 void ErrCheck(const char* where);
+#else
+#define ErrCheck(where)
+#endif
 int  LoadOBJ(const char* file);
 
+//  Matrix and vector math (see mat4.c)
+typedef float vec3[3];
+typedef float vec4[4];
+typedef float quat[4];   //  x,y,z,w
+typedef float mat4[16];  //  Column major
+void Mat4Identity(mat4 M);
+void Mat4Multiply(mat4 R,const mat4 A,const mat4 B);
+void Mat4MultiplyN(mat4 R[],const mat4 A,const mat4 B[],int n);
+void Mat4Transform(vec4 r,const mat4 M,const vec4 v);
+void Mat4Translate(mat4 M,float x,float y,float z);
+void Mat4Rotate(mat4 M,float th,float x,float y,float z);
+void Mat4Scale(mat4 M,float x,float y,float z);
+void Mat4Perspective(mat4 M,double fov,double asp,double zn,double zf);
+void Mat4Ortho(mat4 M,float l,float r,float b,float t,float n,float f);
+void Mat4Project(mat4 M,double fov,double asp,double dim);
+void Mat4LookAt(mat4 M,double ex,double ey,double ez,double cx,double cy,double cz,double ux,double uy,double uz);
+int  Mat4Invert(mat4 R,const mat4 M);
+void Mat4Frustum(vec4 plane[6],const mat4 M);
+int  SphereVisible(const vec4 plane[6],float x,float y,float z,float r);
+void QuatAxis(quat q,float th,float x,float y,float z);
+void QuatMultiply(quat r,const quat a,const quat b);
+void QuatSlerp(quat r,const quat a,const quat b,float t);
+void QuatMat4(mat4 M,const quat q);
+
+//  Shapes (see shapes.c)
+void ShapeMaterial(float shiny,int emission);
+void ShapeDetail(int step);
+void Cube(double x,double y,double z,double dx,double dy,double dz,double th);
+void Ball(double x,double y,double z,double r,int inc);
+void Tetrahedron(double x,double y,double z,double dx,double dy,double dz);
+void Sphere(double x,double y,double z,double r);
+void Cylinder(double x,double y,double z,double radius,double height);
+void HalfTorus(double x,double y,double z,int numc,int numt,double r);
+void UnitCube(void);
+void UnitTetrahedron(void);
+void UnitSphere(void);
+void UnitCylinder(void);
+void UnitHalfTorus(int numc,int numt);
+
+//  Camera paths and input recording (see campath.c)
+int  CameraPath(const char* file);
+int  CameraPathPose(double t,double* x,double* y,double* z,double* th,double* ph);
+void CameraPathFrame(double ms);
+void CameraPathReport(void);
+void CameraPathAppend(const char* file,double x,double y,double z,double th,double ph);
+void RecordEvents(const char* file);
+void RecordEvent(int special,int code);
+void ReplayEvents(const char* file);
+int  ReplayPoll(int t,void (*key)(unsigned char,int,int),void (*special)(int,int,int));
+int  ReplayPending(void);
+
+//  Render queue (see queue.c)
+typedef struct queue_t queue_t;
+enum {SHAPE_CUBE,SHAPE_TETRAHEDRON,SHAPE_SPHERE,SHAPE_CYLINDER,SHAPE_HALFTORUS};
+queue_t* QueueCreate(void);
+void QueueBegin(queue_t* q,const mat4 view);
+void QueueMaterial(queue_t* q,float shiny,int emission);
+void QueueDetail(queue_t* q,int step);
+void QueueShape(queue_t* q,unsigned int texture,int shape,const mat4 model,int numc,int numt);
+void QueueEnd(queue_t* q);
+void QueueFlush(queue_t* q);
+
+//  Transform hierarchy (see graph.c)
+typedef struct graph_t graph_t;
+graph_t*     GraphCreate(void);
+int          GraphAdd(graph_t* g,int parent,const mat4 local);
+void         GraphLocal(graph_t* g,int node,const mat4 local);
+int          GraphUpdate(graph_t* g);
+const float* GraphWorld(const graph_t* g,int node);
+
+//  Scene object store, one aligned array per field (see store.c)
+typedef struct
+{
+   int    n,max;               //  Objects and room
+   float  *x,*y,*z;            //  Position
+   float  *sx,*sy,*sz;         //  Size along each axis
+   float  *cx,*cy,*cz,*r;      //  Bounding sphere
+   unsigned char* shape;       //  SHAPE_CUBE etc.
+   unsigned int*  texture;     //  Texture
+   unsigned int*  flags;       //  Application flags
+   int*   node;                //  Transform graph node (-1 for none)
+   int*   user;                //  Application data
+} store_t;
+void StoreInit(store_t* s);
+int  StoreAdd(store_t* s,int shape,unsigned int texture,float x,float y,float z,float sx,float sy,float sz);
+int  StoreCull(const store_t* s,int n,const vec4 plane[6],const mat4 view,int* index,float* depth);
+
+//  GPU culling and drawing of plain cubes (see gpucull.c)
+typedef struct gpucull_t gpucull_t;
+gpucull_t* GpuCullCreate(const store_t* s,int first);
+void GpuCullDraw(gpucull_t* g,const vec4 plane[6],int lighting,int local,float shiny,int emission);
+int  GpuCullVisible(gpucull_t* g);
+
+//  Software occlusion culling (see occlude.c)
+typedef struct occlusion_t occlusion_t;
+occlusion_t* OcclusionCreate(int w,int h);
+void OcclusionBegin(occlusion_t* o,const mat4 PV);
+void OcclusionBox(occlusion_t* o,const mat4 model);
+void OcclusionRender(occlusion_t* o);
+int  OcclusionVisible(const occlusion_t* o,const mat4 model);
+
+//  Work-stealing jobs (see jobs.c)
+typedef struct job_t job_t;
+void   JobInit(int n);
+int    JobWorkers(void);
+job_t* JobCreate(void (*func)(void* arg),void* arg);
+void   JobAfter(job_t* job,job_t* before);
+void   JobRun(job_t* job);
+void   JobWait(job_t* job);
+void   JobRelease(job_t* job);
+void   JobFor(int n,int grain,void (*func)(int i0,int i1,void* arg),void* arg);
+
+//  GPU pass timing and overlay (see perf.c)
+void PerfFrame(void);
+void PerfFrameEnd(void);
+void PerfBegin(const char* name);
+void PerfEnd(const char* name);
+void PerfOverlay(void);
+void PerfDraws(int draws,int triangles);
+
+//  OpenGL call counting and redundant state filtering (see glwrap.c)
+#if defined(GLCOUNT) || defined(GLCACHE)
+typedef struct
+{
+   int draws;      //  glBegin/glEnd batches, rectangles and list calls
+   int vertices;   //  Vertexes
+   int states;     //  State changes
+   int redundant;  //  State changes to the current value
+   int skipped;    //  Redundant state changes dropped
+} glcount_t;
+void GLCountFrame(void);
+const glcount_t* GLCounts(void);
+void GLCache(int on);
+#ifdef GLCOUNT
+void GLWBegin(GLenum mode);
+void GLWEnd(void);
+void GLWRecti(GLint x1,GLint y1,GLint x2,GLint y2);
+void GLWVertex2d(GLdouble x,GLdouble y);
+void GLWVertex3d(GLdouble x,GLdouble y,GLdouble z);
+void GLWVertex3f(GLfloat x,GLfloat y,GLfloat z);
+void GLWVertex3fv(const GLfloat* v);
+void GLWVertex3dv(const GLdouble* v);
+#endif
+void GLWNewList(GLuint list,GLenum mode);
+void GLWEndList(void);
+void GLWCallList(GLuint list);
+void GLWPopAttrib(void);
+void GLWEnable(GLenum cap);
+void GLWDisable(GLenum cap);
+void GLWBindTexture(GLenum target,GLuint texture);
+void GLWDeleteTextures(GLsizei n,const GLuint* textures);
+void GLWMaterialfv(GLenum face,GLenum pname,const GLfloat* params);
+void GLWMaterialf(GLenum face,GLenum pname,GLfloat param);
+void GLWLightfv(GLenum light,GLenum pname,const GLfloat* params);
+void GLWLightModeli(GLenum pname,GLint param);
+void GLWColorMaterial(GLenum face,GLenum mode);
+void GLWColor3f(GLfloat r,GLfloat g,GLfloat b);
+#endif
+
+//  Scoped tracing (see trace.c)
+#ifdef TRACE
+typedef struct
+{
+   const char* name;
+   long long   t0;
+} TraceZone;
+long long TraceNow(void);
+void TraceZoneEnd(TraceZone* z);
+void TraceOpen(const char* file);
+#define TRACE_VAR2(line) traceZone##line
+#define TRACE_VAR(line)  TRACE_VAR2(line)
+#define Trace(name) TraceZone TRACE_VAR(__LINE__) __attribute__((cleanup(TraceZoneEnd))) = {name,TraceNow()}
+#else
+#define Trace(name)
+#define TraceOpen(file) fprintf(stderr,"Not writing %s: build with make TRACE=1\n",file)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
 
+//  Count OpenGL calls and drop redundant state changes
+#if (defined(GLCOUNT) || defined(GLCACHE)) && !defined(GLWRAP_IMPL)
+//  Drawing is only wrapped to count it
+#ifdef GLCOUNT
+#define glBegin(mode)             GLWBegin(mode)
+#define glEnd()                   GLWEnd()
+#define glRecti(x1,y1,x2,y2)      GLWRecti(x1,y1,x2,y2)
+#define glVertex2d(x,y)           GLWVertex2d(x,y)
+#define glVertex3d(x,y,z)         GLWVertex3d(x,y,z)
+#define glVertex3f(x,y,z)         GLWVertex3f(x,y,z)
+#define glVertex3fv(v)            GLWVertex3fv(v)
+#define glVertex3dv(v)            GLWVertex3dv(v)
+#endif
+#define glNewList(list,mode)      GLWNewList(list,mode)
+#define glEndList()               GLWEndList()
+#define glCallList(list)          GLWCallList(list)
+#define glPopAttrib()             GLWPopAttrib()
+#define glEnable(cap)             GLWEnable(cap)
+#define glDisable(cap)            GLWDisable(cap)
+#define glBindTexture(t,tex)      GLWBindTexture(t,tex)
+#define glDeleteTextures(n,tex)   GLWDeleteTextures(n,tex)
+#define glMaterialfv(f,p,v)       GLWMaterialfv(f,p,v)
+#define glMaterialf(f,p,v)        GLWMaterialf(f,p,v)
+#define glLightfv(l,p,v)          GLWLightfv(l,p,v)
+#define glLightModeli(p,v)        GLWLightModeli(p,v)
+#define glColorMaterial(f,m)      GLWColorMaterial(f,m)
+#define glColor3f(r,g,b)          GLWColor3f(r,g,b)
+#endif
+
 #endif
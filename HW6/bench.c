@@ -0,0 +1,481 @@
+/*
+ *  Microbenchmarks for the CSCIx229 library
+ *
+ *  bench [-reps N] [-time ms] [-json] [-jobs N] [name ...]
+ *    -reps N    timed repetitions of each benchmark (default 10)
+ *    -time ms   minimum duration of one repetition (default 50)
+ *    -json      print one JSON line per benchmark instead of a table
+ *    -jobs N    job system worker threads (default cores-1)
+ *    name       only run benchmarks whose name starts with name
+ *
+ *  Each benchmark is calibrated to take at least the minimum time per
+ *  repetition and then repeated.  The median time per iteration and the
+ *  throughput at the median are reported along with the spread.
+ *
+ *  Runs in a headless OpenGL context (see headless.c) so the texture,
+ *  OBJ and shape benchmarks include the driver work they cause.
+ */
+#include "CSCIx229.h"
+#include <time.h>
+
+//  Benchmark: runs n iterations and returns the units of work done
+typedef struct
+{
+   const char* name;
+   const char* unit;             //  Unit of work (for throughput)
+   double (*run)(int n,int arg);
+   int arg;
+} bench_t;
+
+static int reps=10;              //  Timed repetitions
+static double minms=50;          //  Minimum ms per repetition
+static int json=0;               //  JSON output
+static volatile double sink;     //  Keeps results alive
+
+//  Synthetic inputs
+static const int   bmpsize[] = {256,512,1024};
+static const char* bmpfile[] = {"bench-256.bmp","bench-512.bmp","bench-1024.bmp"};
+static const int   objsize[] = {32,128,256};
+static const char* objfile[] = {"bench-32.obj","bench-128.obj","bench-256.obj"};
+
+/*
+ *  Elapsed time in ms
+ */
+static double Now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return 1e3*ts.tv_sec + 1e-6*ts.tv_nsec;
+}
+
+static int CompareDouble(const void* a,const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x>y) - (x<y);
+}
+
+/*
+ *  Write a little endian integer
+ */
+static void PutInt(FILE* f,unsigned int x,int n)
+{
+   int k;
+   for (k=0;k<n;k++)
+      fputc((x>>(8*k))&0xFF,f);
+}
+
+/*
+ *  Write an n x n 24 bit BMP with a color gradient
+ */
+static void WriteBMP(const char* file,int n)
+{
+   int i,j;
+   FILE* f = fopen(file,"wb");
+   if (!f) Fatal("Cannot create %s\n",file);
+   fputc('B',f); fputc('M',f);
+   PutInt(f,54+3*n*n,4);
+   PutInt(f,0,4);
+   PutInt(f,54,4);   //  Image offset
+   PutInt(f,40,4);   //  Header size
+   PutInt(f,n,4);
+   PutInt(f,n,4);
+   PutInt(f,1,2);    //  Planes
+   PutInt(f,24,2);   //  Bits per pixel
+   PutInt(f,0,4);    //  No compression
+   PutInt(f,3*n*n,4);
+   PutInt(f,2835,4);
+   PutInt(f,2835,4);
+   PutInt(f,0,4);
+   PutInt(f,0,4);
+   for (j=0;j<n;j++)
+      for (i=0;i<n;i++)
+      {
+         fputc(255*i/n,f);
+         fputc(255*j/n,f);
+         fputc((i^j)&0xFF,f);
+      }
+   fclose(f);
+}
+
+/*
+ *  Write an OBJ with an n x n grid of quads over a bumpy surface
+ */
+static void WriteOBJ(const char* file,int n)
+{
+   int i,j;
+   FILE* f = fopen(file,"w");
+   if (!f) Fatal("Cannot create %s\n",file);
+   for (j=0;j<=n;j++)
+      for (i=0;i<=n;i++)
+      {
+         double x = (double)i/n, z = (double)j/n;
+         fprintf(f,"v %f %f %f\n",x,0.1*Sin(720*x)*Cos(720*z),z);
+         fprintf(f,"vn %f %f %f\n",0.0,1.0,0.0);
+         fprintf(f,"vt %f %f\n",x,z);
+      }
+   for (j=0;j<n;j++)
+      for (i=0;i<n;i++)
+      {
+         int k = j*(n+1)+i+1;
+         fprintf(f,"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+            k,k,k, k+1,k+1,k+1, k+n+2,k+n+2,k+n+2, k+n+1,k+n+1,k+n+1);
+      }
+   fclose(f);
+}
+
+/*
+ *  Size of a file in bytes
+ */
+static double FileSize(const char* file)
+{
+   double size;
+   FILE* f = fopen(file,"rb");
+   if (!f) Fatal("Cannot open %s\n",file);
+   fseek(f,0,SEEK_END);
+   size = ftell(f);
+   fclose(f);
+   return size;
+}
+
+//  LoadTexBMP decode and upload (bytes)
+static double BenchTexBMP(int n,int arg)
+{
+   int k;
+   for (k=0;k<n;k++)
+   {
+      unsigned int tex = LoadTexBMP(bmpfile[arg]);
+      glDeleteTextures(1,&tex);
+   }
+   return n*FileSize(bmpfile[arg]);
+}
+
+//  LoadTexBMPs of 8 files decoded on the job system (bytes)
+static double BenchTexBMPs(int n,int arg)
+{
+   int k;
+   const char*  file[8];
+   unsigned int tex[8];
+   for (k=0;k<8;k++)
+      file[k] = bmpfile[arg];
+   for (k=0;k<n;k++)
+   {
+      LoadTexBMPs(8,file,tex);
+      glDeleteTextures(8,tex);
+   }
+   return 8*n*FileSize(bmpfile[arg]);
+}
+
+//  LoadOBJ parse and display list build (bytes)
+static double BenchOBJ(int n,int arg)
+{
+   int k;
+   for (k=0;k<n;k++)
+   {
+      int list = LoadOBJ(objfile[arg]);
+      glDeleteLists(list,1);
+   }
+   return n*FileSize(objfile[arg]);
+}
+
+//  Sin and Cos macros (calls)
+static double BenchSinCos(int n,int arg)
+{
+   int k;
+   double sum=0;
+   for (k=0;k<n;k++)
+   {
+      double th = 0.37*k;
+      sum += Sin(th) + Cos(th);
+   }
+   sink = sum;
+   return 2.0*n;
+}
+
+//  Shape tessellation into a display list (shapes)
+static double BenchShape(int n,int arg)
+{
+   int k;
+   int list = glGenLists(1);
+   for (k=0;k<n;k++)
+   {
+      glNewList(list,GL_COMPILE);
+      if (arg==0)
+         Sphere(0,0,0,1);
+      else if (arg==1)
+         Cylinder(0,0,0,1,1);
+      else
+         HalfTorus(0,0,0,8,26,1);
+      glEndList();
+   }
+   glDeleteLists(list,1);
+   return n;
+}
+
+//  Modelview matrixes of 1024 objects in one batch (matrixes)
+static double BenchMat4(int n,int arg)
+{
+   static mat4 model[1024],mv[1024];
+   mat4 V;
+   int k;
+   Mat4LookAt(V,1,2,3,0,0,0,0,1,0);
+   for (k=0;k<1024;k++)
+   {
+      Mat4Identity(model[k]);
+      Mat4Translate(model[k],k,0,-k);
+      Mat4Rotate(model[k],k,0,1,0);
+   }
+   for (k=0;k<n;k++)
+      Mat4MultiplyN(mv,V,(const mat4*)model,1024);
+   sink = mv[1023][14];
+   return 1024.0*n;
+}
+
+//  Frustum culling of a store of a million cubes (objects)
+static double BenchCull(int n,int arg)
+{
+   static store_t store;
+   static int*    index;
+   static float*  depth;
+   mat4 P,V,PV;
+   vec4 plane[6];
+   int k;
+   if (!store.n)
+   {
+      StoreInit(&store);
+      for (k=0;k<1000000;k++)
+         StoreAdd(&store,SHAPE_CUBE,0,(k%1000)*0.3-150,0.5,-(k/1000)*0.3,0.1,0.5,0.1);
+      index = (int*)malloc(store.n*sizeof(int));
+      depth = (float*)malloc(store.n*sizeof(float));
+      if (!index || !depth) Fatal("Cannot allocate culling\n");
+   }
+   Mat4Project(P,58,1,100);
+   Mat4LookAt(V,0,2,5,0,0,-1,0,1,0);
+   Mat4Multiply(PV,P,V);
+   Mat4Frustum(plane,PV);
+   for (k=0;k<n;k++)
+      sink = StoreCull(&store,store.n,plane,V,index,depth);
+   return 1e6*n;
+}
+
+//  GPU culling and drawing of 100k cubes with two textures (objects)
+//    The first call checks that the GPU finds the cubes StoreCull does
+static double BenchGpuCull(int n,int arg)
+{
+   static store_t    store;
+   static gpucull_t* g;
+   static vec4 plane[6];
+   mat4 P,V,PV;
+   int k;
+   if (!store.n)
+   {
+      GLuint tex[2];
+      unsigned char white[3] = {255,255,255};
+      int*   index;
+      float* depth;
+      glGenTextures(2,tex);
+      for (k=0;k<2;k++)
+      {
+         glBindTexture(GL_TEXTURE_2D,tex[k]);
+         glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,1,1,0,GL_RGB,GL_UNSIGNED_BYTE,white);
+      }
+      glBindTexture(GL_TEXTURE_2D,0);
+      StoreInit(&store);
+      for (k=0;k<100000;k++)
+         StoreAdd(&store,SHAPE_CUBE,tex[k%2],(k%316)*0.3-47,0.5,-(k/316)*0.3,0.1,0.5,0.1);
+      g = GpuCullCreate(&store,0);
+      if (!g) return -1;
+      Mat4Project(P,58,1,100);
+      Mat4LookAt(V,0,2,5,0,0,-1,0,1,0);
+      Mat4Multiply(PV,P,V);
+      Mat4Frustum(plane,PV);
+      glMatrixMode(GL_PROJECTION);
+      glLoadMatrixf(P);
+      glMatrixMode(GL_MODELVIEW);
+      glLoadMatrixf(V);
+      //  Same objects in view as on the CPU
+      index = (int*)malloc(store.n*sizeof(int));
+      depth = (float*)malloc(store.n*sizeof(float));
+      if (!index || !depth) Fatal("Cannot allocate culling\n");
+      k = StoreCull(&store,store.n,plane,V,index,depth);
+      GpuCullDraw(g,plane,0,0,1,0);
+      if (GpuCullVisible(g)!=k) Fatal("GPU culling found %d objects, StoreCull %d\n",GpuCullVisible(g),k);
+      free(index);
+      free(depth);
+   }
+   if (!g) return -1;
+   for (k=0;k<n;k++)
+      GpuCullDraw(g,plane,0,0,1,0);
+   glFinish();
+   return 1e5*n;
+}
+
+//  Occlusion culling of 4096 cubes behind a row of 64 (tests)
+static double BenchOcclude(int n,int arg)
+{
+   static occlusion_t* occ;
+   static mat4 box[64+4096];
+   mat4 P,V,PV;
+   int i,k;
+   if (!occ)
+   {
+      occ = OcclusionCreate(256,128);
+      for (k=0;k<64+4096;k++)
+      {
+         Mat4Identity(box[k]);
+         if (k<64)
+         {
+            Mat4Translate(box[k],(k-32)*0.5,1,-2);
+            Mat4Scale(box[k],0.25,1,0.25);
+         }
+         else
+         {
+            Mat4Translate(box[k],((k-64)%64-32)*0.5,0.5,-4-0.3*((k-64)/64));
+            Mat4Scale(box[k],0.1,0.5,0.1);
+         }
+      }
+   }
+   Mat4Project(P,58,2,8);
+   Mat4LookAt(V,0,1,5,0,1,-1,0,1,0);
+   Mat4Multiply(PV,P,V);
+   for (k=0;k<n;k++)
+   {
+      int hidden=0;
+      OcclusionBegin(occ,PV);
+      for (i=0;i<64;i++)
+         OcclusionBox(occ,box[i]);
+      OcclusionRender(occ);
+      for (i=64;i<64+4096;i++)
+         hidden += !OcclusionVisible(occ,box[i]);
+      sink = hidden;
+   }
+   return 4096.0*n;
+}
+
+static bench_t benches[] =
+{
+   {"texbmp/256",      "B",      BenchTexBMP, 0},
+   {"texbmp/512",      "B",      BenchTexBMP, 1},
+   {"texbmp/1024",     "B",      BenchTexBMP, 2},
+   {"texbmps/512x8",   "B",      BenchTexBMPs,1},
+   {"obj/32x32",       "B",      BenchOBJ,    0},
+   {"obj/128x128",     "B",      BenchOBJ,    1},
+   {"obj/256x256",     "B",      BenchOBJ,    2},
+   {"sincos",          "calls",  BenchSinCos, 0},
+   {"shape/sphere",    "shapes", BenchShape,  0},
+   {"shape/cylinder",  "shapes", BenchShape,  1},
+   {"shape/halftorus", "shapes", BenchShape,  2},
+   {"mat4/1024",       "mats",   BenchMat4,   0},
+   {"cull/1M",         "objects",BenchCull,   0},
+   {"gpucull/100k",    "objects",BenchGpuCull,0},
+   {"occlude/4096",    "tests",  BenchOcclude,0},
+};
+#define NBENCH (int)(sizeof(benches)/sizeof(bench_t))
+
+/*
+ *  Calibrate, repeat and report one benchmark
+ */
+static void Run(bench_t* b)
+{
+   int    k,n=1;
+   double work=0,mean=0,var=0,med;
+   double* ms = (double*)malloc(reps*sizeof(double));
+   if (!ms) Fatal("Cannot allocate %d repetitions\n",reps);
+
+   //  Double the iterations until one repetition takes long enough
+   //  (work below zero means the driver cannot run it)
+   for (;;)
+   {
+      double t = Now();
+      if (b->run(n,b->arg)<0)
+      {
+         if (!json) printf("%-16s not supported\n",b->name);
+         free(ms);
+         return;
+      }
+      t = Now()-t;
+      if (t>=minms || n>=(1<<30)) break;
+      n *= (t<minms/16) ? 16 : 2;
+   }
+   //  Timed repetitions (ms per iteration)
+   for (k=0;k<reps;k++)
+   {
+      double t = Now();
+      work = b->run(n,b->arg);
+      ms[k] = (Now()-t)/n;
+      mean += ms[k];
+   }
+   mean /= reps;
+   for (k=0;k<reps;k++)
+      var += (ms[k]-mean)*(ms[k]-mean);
+   var = reps>1 ? var/(reps-1) : 0;
+   qsort(ms,reps,sizeof(double),CompareDouble);
+   med = reps%2 ? ms[reps/2] : 0.5*(ms[reps/2-1]+ms[reps/2]);
+
+   //  Throughput at the median
+   work /= n;
+   if (json)
+      printf("{\"name\": \"%s\", \"iters\": %d, \"reps\": %d, \"median_us\": %.4f, \"min_us\": %.4f, \"max_us\": %.4f, \"stddev_us\": %.4f, \"unit\": \"%s\", \"per_s\": %.6g}\n",
+         b->name,n,reps,1e3*med,1e3*ms[0],1e3*ms[reps-1],1e3*sqrt(var),b->unit,1e3*work/med);
+   else
+      printf("%-16s %10d %12.3f %12.3f %7.1f%% %12.4g %s/s\n",
+         b->name,n,1e3*med,1e3*ms[0],100*sqrt(var)/mean,1e3*work/med,b->unit);
+   fflush(stdout);
+   free(ms);
+}
+
+int main(int argc,char* argv[])
+{
+   int  k,i,any;
+   char opt[] = "-headless", one[] = "1";
+   char* hargv[] = {argv[0],opt,one,NULL};
+   int   hargc = 3;
+
+   //  Options
+   for (k=1;k<argc && argv[k][0]=='-';k++)
+   {
+      if (!strcmp(argv[k],"-reps") && k+1<argc)
+         reps = atoi(argv[++k]);
+      else if (!strcmp(argv[k],"-time") && k+1<argc)
+         minms = atof(argv[++k]);
+      else if (!strcmp(argv[k],"-json"))
+         json = 1;
+      else if (!strcmp(argv[k],"-jobs") && k+1<argc)
+         JobInit(atoi(argv[++k]));
+      else
+         Fatal("Usage: %s [-reps N] [-time ms] [-json] [-jobs N] [name ...]\n",argv[0]);
+   }
+   if (reps<1) reps = 1;
+
+   //  OpenGL context for the loaders and shapes
+   if (!Headless(&hargc,hargv)) Fatal("Cannot create OpenGL context\n");
+   if (!json)
+   {
+      printf("Renderer %s\n",(char*)glGetString(GL_RENDERER));
+      printf("%-16s %10s %12s %12s %8s %12s\n","benchmark","iters","median_us","min_us","stddev","throughput");
+   }
+
+   //  Synthetic inputs
+   for (i=0;i<3;i++)
+   {
+      WriteBMP(bmpfile[i],bmpsize[i]);
+      WriteOBJ(objfile[i],objsize[i]);
+   }
+
+   for (i=0;i<NBENCH;i++)
+   {
+      //  Name filter
+      any = (k==argc);
+      for (int j=k;j<argc;j++)
+         if (!strncmp(benches[i].name,argv[j],strlen(argv[j])))
+            any = 1;
+      if (any) Run(benches+i);
+   }
+
+   for (i=0;i<3;i++)
+   {
+      remove(bmpfile[i]);
+      remove(objfile[i]);
+   }
+   return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ *  Camera paths and input recording for repeatable benchmarks
+ *
+ *  Path file: one keyframe per line
+ *    time EX EY EZ th ph [segment]
+ *  Time is in seconds and must increase.  The eye position and view
+ *  angles are interpolated with a Catmull-Rom spline.  A keyframe with a
+ *  segment name starts a new segment that runs to the next named
+ *  keyframe, and frame times are reported separately for each segment.
+ *  Lines starting with # are comments.
+ *
+ *  Event file: one input event per line
+ *    ms key|special code
+ *  Time is in milliseconds from program start.
+ */
+#include "CSCIx229.h"
+
+#define MAXKEYS 256  //  Maximum keyframes in a path
+#define MAXSEGS 32   //  Maximum named segments
+
+//  Keyframe
+typedef struct
+{
+   double t;        //  Time (s)
+   double v[5];     //  EX,EY,EZ,th,ph
+   int    seg;      //  Segment index
+} keyframe_t;
+
+//  Segment timings
+typedef struct
+{
+   char    name[64];
+   int     n,max;   //  Frame count and allocated
+   double* ms;      //  Frame times
+} seg_t;
+
+static keyframe_t keys[MAXKEYS];
+static int   Nkeys=0;
+static seg_t segs[MAXSEGS];
+static int   Nsegs=0;
+static int   cur=-1;        //  Segment of the last pose (-1 past the end)
+                            //  Atomic since frames may be charged on another thread
+
+//  Event recording and playback
+static FILE* rec=NULL;      //  Recording file
+typedef struct
+{
+   int t,special,code;
+} event_t;
+static event_t* events=NULL;
+static int      Nevents=0,next=0;
+
+/*
+ *  Load a camera path
+ *    Returns the number of keyframes
+ */
+int CameraPath(const char* file)
+{
+   char line[256];
+   int  ln=0;
+   FILE* f = fopen(file,"r");
+   if (!f) Fatal("Cannot open camera path %s\n",file);
+   Nkeys = Nsegs = 0;
+   while (fgets(line,sizeof(line),f))
+   {
+      keyframe_t* k = keys+Nkeys;
+      char name[64]="";
+      int  n;
+      ln++;
+      if (line[0]=='#' || strspn(line," \t\r\n")==strlen(line)) continue;
+      n = sscanf(line,"%lf %lf %lf %lf %lf %lf %63s",&k->t,k->v,k->v+1,k->v+2,k->v+3,k->v+4,name);
+      if (n<6) Fatal("%s:%d: expected time EX EY EZ th ph [segment]\n",file,ln);
+      if (Nkeys==MAXKEYS) Fatal("%s: more than %d keyframes\n",file,MAXKEYS);
+      if (Nkeys>0 && k->t<=keys[Nkeys-1].t) Fatal("%s:%d: keyframe times must increase\n",file,ln);
+      //  Start a new segment when named (the first keyframe always starts one)
+      if (name[0] || Nsegs==0)
+      {
+         if (Nsegs==MAXSEGS) Fatal("%s: more than %d segments\n",file,MAXSEGS);
+         snprintf(segs[Nsegs].name,sizeof(segs[Nsegs].name),"%s",name[0]?name:"start");
+         segs[Nsegs].n = 0;
+         Nsegs++;
+      }
+      k->seg = Nsegs-1;
+      Nkeys++;
+   }
+   fclose(f);
+   if (Nkeys<2) Fatal("%s: a camera path needs at least two keyframes\n",file);
+   return Nkeys;
+}
+
+/*
+ *  Camera pose at time t (seconds)
+ *    Returns 0 once t is past the last keyframe (the pose stays there)
+ */
+int CameraPathPose(double t,double* x,double* y,double* z,double* th,double* ph)
+{
+   int    i,k=0,seg;
+   double v[5];
+   if (Nkeys<2) return 0;
+   if (t>=keys[Nkeys-1].t)
+   {
+      for (i=0;i<5;i++)
+         v[i] = keys[Nkeys-1].v[i];
+      seg = -1;
+   }
+   else
+   {
+      double h,s,s2,s3;
+      keyframe_t *p0,*p1,*p2,*p3;
+      if (t<keys[0].t) t = keys[0].t;
+      while (keys[k+1].t<=t) k++;
+      //  Neighbours for the tangents (ends reuse the end keyframe)
+      p0 = keys + (k>0 ? k-1 : k);
+      p1 = keys + k;
+      p2 = keys + k+1;
+      p3 = keys + (k+2<Nkeys ? k+2 : k+1);
+      h  = p2->t - p1->t;
+      s  = (t - p1->t)/h;
+      s2 = s*s;
+      s3 = s2*s;
+      //  Cubic Hermite with Catmull-Rom tangents scaled to the interval
+      for (i=0;i<5;i++)
+      {
+         double m1 = (p2->v[i]-p0->v[i])/(p2->t-p0->t)*h;
+         double m2 = (p3->v[i]-p1->v[i])/(p3->t-p1->t)*h;
+         v[i] = (2*s3-3*s2+1)*p1->v[i] + (s3-2*s2+s)*m1 + (-2*s3+3*s2)*p2->v[i] + (s3-s2)*m2;
+      }
+      seg = p1->seg;
+   }
+   __atomic_store_n(&cur,seg,__ATOMIC_RELAXED);
+   *x = v[0]; *y = v[1]; *z = v[2];
+   *th = v[3]; *ph = v[4];
+   return seg>=0;
+}
+
+/*
+ *  Charge a frame time (ms) to the segment of the last pose
+ */
+void CameraPathFrame(double ms)
+{
+   seg_t* s;
+   int    k = __atomic_load_n(&cur,__ATOMIC_RELAXED);
+   if (k<0) return;
+   s = segs+k;
+   if (s->n==s->max)
+   {
+      s->max = s->max ? 2*s->max : 256;
+      s->ms = (double*)realloc(s->ms,s->max*sizeof(double));
+      if (!s->ms) Fatal("Cannot allocate %d frame times\n",s->max);
+   }
+   s->ms[s->n++] = ms;
+}
+
+static int CompareDouble(const void* a,const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x>y) - (x<y);
+}
+
+/*
+ *  Print frame time statistics for each segment
+ */
+void CameraPathReport(void)
+{
+   int i,j;
+   if (!Nsegs) return;
+   printf("%-16s %7s %9s %9s %9s %9s\n","segment","frames","mean_ms","p50_ms","p95_ms","max_ms");
+   for (i=0;i<Nsegs;i++)
+   {
+      seg_t* s = segs+i;
+      double sum=0;
+      if (!s->n)
+      {
+         printf("%-16s %7d\n",s->name,0);
+         continue;
+      }
+      qsort(s->ms,s->n,sizeof(double),CompareDouble);
+      for (j=0;j<s->n;j++)
+         sum += s->ms[j];
+      printf("%-16s %7d %9.3f %9.3f %9.3f %9.3f\n",s->name,s->n,sum/s->n,
+         s->ms[(int)ceil(0.50*s->n)-1],s->ms[(int)ceil(0.95*s->n)-1],s->ms[s->n-1]);
+   }
+}
+
+/*
+ *  Append the current pose to a path file as a keyframe
+ *    Keyframe times are seconds since the first keyframe was added
+ */
+void CameraPathAppend(const char* file,double x,double y,double z,double th,double ph)
+{
+   static int t0=-1;
+   int t = glutGet(GLUT_ELAPSED_TIME);
+   FILE* f = fopen(file,"a");
+   if (!f)
+   {
+      fprintf(stderr,"Cannot append to %s\n",file);
+      return;
+   }
+   if (t0<0) t0 = t;
+   fprintf(f,"%.2f %.3f %.3f %.3f %.1f %.1f\n",(t-t0)/1000.0,x,y,z,th,ph);
+   fclose(f);
+}
+
+/*
+ *  Record input events to a file
+ */
+void RecordEvents(const char* file)
+{
+   rec = fopen(file,"w");
+   if (!rec) Fatal("Cannot open event recording %s\n",file);
+}
+
+void RecordEvent(int special,int code)
+{
+   if (!rec) return;
+   //  Same clock as the simulation steps the events are replayed in
+   fprintf(rec,"%d %s %d\n",SimTime(),special?"special":"key",code);
+   fflush(rec);
+}
+
+/*
+ *  Load recorded input events for playback
+ */
+void ReplayEvents(const char* file)
+{
+   char word[16];
+   int  t,code,max=0;
+   FILE* f = fopen(file,"r");
+   if (!f) Fatal("Cannot open event recording %s\n",file);
+   while (fscanf(f,"%d %15s %d",&t,word,&code)==3)
+   {
+      if (Nevents==max)
+      {
+         max = max ? 2*max : 256;
+         events = (event_t*)realloc(events,max*sizeof(event_t));
+         if (!events) Fatal("Cannot allocate %d events\n",max);
+      }
+      events[Nevents].t = t;
+      events[Nevents].special = !strcmp(word,"special");
+      events[Nevents].code = code;
+      Nevents++;
+   }
+   fclose(f);
+   next = 0;
+}
+
+/*
+ *  Deliver the recorded events that are due at time t (ms)
+ *    Returns 1 if any event was delivered
+ */
+int ReplayPoll(int t,void (*key)(unsigned char,int,int),void (*special)(int,int,int))
+{
+   int any=0;
+   while (next<Nevents && events[next].t<=t)
+   {
+      event_t* e = events + next++;
+      if (e->special)
+         special(e->code,0,0);
+      else
+         key((unsigned char)e->code,0,0);
+      any = 1;
+   }
+   return any;
+}
+
+/*
+ *  Recorded events still waiting to be delivered
+ */
+int ReplayPending(void)
+{
+   return next<Nevents;
+}
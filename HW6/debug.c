@@ -0,0 +1,141 @@
+/*
+ *  OpenGL debug output
+ *
+ *  GLDebug asks the driver to report errors and warnings through a
+ *  KHR_debug callback instead of polling glGetError, which waits for the
+ *  driver to catch up with every call made before it.  Notifications are
+ *  filtered out, and each distinct message is printed the first few times
+ *  it is seen and then only at powers of two, so an error made every frame
+ *  does not flood stderr.
+ *
+ *  Built with make GLDEBUG=1 the messages are delivered synchronously, so
+ *  a breakpoint in Report stops in the call that caused them, and ErrCheck
+ *  checks glGetError as well.  Otherwise ErrCheck compiles to nothing.
+ */
+#include "CSCIx229.h"
+
+#define SITES   256  //  Distinct messages counted (power of two)
+#define REPEATS 3    //  Times a message is printed before rate limiting
+
+#ifndef GLAPIENTRY
+#define GLAPIENTRY APIENTRY
+#endif
+
+//  Message count
+typedef struct
+{
+   unsigned key;
+   unsigned count;
+} site_t;
+
+static site_t sites[SITES];
+
+/*
+ *  Count a message from a site
+ *    Returns the count if it should be printed, otherwise 0
+ *    The callback may run on a driver thread, so this is lock-free
+ */
+static unsigned Limit(unsigned key)
+{
+   unsigned k,n;
+   if (!key) key = 1;
+   for (k=0;k<SITES;k++)
+   {
+      site_t*  s = sites+((key+k)&(SITES-1));
+      unsigned old = __atomic_load_n(&s->key,__ATOMIC_ACQUIRE);
+      if (!old && __atomic_compare_exchange_n(&s->key,&old,key,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE))
+         old = key;
+      if (old==key)
+      {
+         n = __atomic_add_fetch(&s->count,1,__ATOMIC_RELAXED);
+         return (n<=REPEATS || !(n&(n-1))) ? n : 0;
+      }
+   }
+   //  Table full - print everything
+   return 1;
+}
+
+/*
+ *  Print a message with its repeat count
+ */
+static void Message(unsigned n,const char* kind,const char* what,const char* where)
+{
+   if (n>REPEATS)
+      fprintf(stderr,"%s: %s [%s] (%u times)\n",kind,what,where,n);
+   else
+      fprintf(stderr,"%s: %s [%s]\n",kind,what,where);
+}
+
+#ifdef GL_DEBUG_OUTPUT
+static const char* Source(GLenum source)
+{
+   switch (source)
+   {
+      case GL_DEBUG_SOURCE_API:             return "API";
+      case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window system";
+      case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+      case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+      case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+   }
+   return "other";
+}
+
+/*
+ *  Debug output callback
+ */
+static void GLAPIENTRY Report(GLenum source,GLenum type,GLuint id,GLenum severity,GLsizei length,const GLchar* message,const void* user)
+{
+   const char* kind = type==GL_DEBUG_TYPE_ERROR ? "ERROR" :
+                      type==GL_DEBUG_TYPE_PERFORMANCE ? "PERFORMANCE" : "WARNING";
+   //  Drivers may use one id for many messages, so the text is counted too
+   unsigned n,key = (source*31+type)*31+id;
+   const char* c;
+   for (c=message;*c;c++)
+      key = (key^(unsigned char)*c)*16777619u;
+   n = Limit(key);
+   if (n) Message(n,kind,message,Source(source));
+}
+#endif
+
+/*
+ *  Report OpenGL errors and warnings through debug output
+ *    Call once the context exists
+ *    Returns 0 if the driver has no debug output
+ */
+int GLDebug(void)
+{
+   int major=0,minor=0;
+   const char* ver = (const char*)glGetString(GL_VERSION);
+   const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+   if (ver) sscanf(ver,"%d.%d",&major,&minor);
+   if (!(major>4 || (major==4 && minor>=3) || (ext && strstr(ext,"GL_KHR_debug"))))
+      return 0;
+#ifdef GL_DEBUG_OUTPUT
+   glDebugMessageCallback(Report,NULL);
+   //  Everything but notifications
+   glDebugMessageControl(GL_DONT_CARE,GL_DONT_CARE,GL_DONT_CARE,0,NULL,GL_TRUE);
+   glDebugMessageControl(GL_DONT_CARE,GL_DONT_CARE,GL_DEBUG_SEVERITY_NOTIFICATION,0,NULL,GL_FALSE);
+   glEnable(GL_DEBUG_OUTPUT);
+#ifdef GLDEBUG
+   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+   return 1;
+#else
+   return 0;
+#endif
+}
+
+#ifdef GLDEBUG
+/*
+ *  Check for OpenGL errors (waits for the driver)
+ */
+void ErrCheck(const char* where)
+{
+   int err = glGetError();
+   if (err)
+   {
+      unsigned n = Limit((unsigned)(size_t)where*2654435761u ^ err);
+      if (n) Message(n,"ERROR",(const char*)gluErrorString(err),where);
+   }
+}
+#endif
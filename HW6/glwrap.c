@@ -0,0 +1,400 @@
+/*
+ *  OpenGL call counting and redundant state filtering
+ *
+ *  When built with -DGLCOUNT or -DGLCACHE CSCIx229.h replaces the state
+ *  calls used by the library and hw6 with the wrappers below, and with
+ *  -DGLCOUNT the drawing calls too.  They count draws, vertexes, state
+ *  changes and state changes that set a value that is already current,
+ *  then call OpenGL.  With -DGLCACHE the redundant state changes are
+ *  dropped instead of passed on, unless turned off with GLCache(0).
+ *  Builds with only -DGLCACHE leave glBegin, glVertex and glEnd alone,
+ *  so immediate mode drawing costs nothing extra.
+ *
+ *  Redundancy is found by shadowing the state each wrapper sets.  A
+ *  shadow value is only trusted after the program has set it, and all
+ *  of it is forgotten when something else may have changed the state
+ *  (glPopAttrib, glCallList).  Calls compiled into a display list do
+ *  not change the state, so they are not counted or shadowed, and
+ *  nothing is dropped while a display list is being built.
+ */
+#define GLWRAP_IMPL
+#include "CSCIx229.h"
+#if defined(GLCOUNT) || defined(GLCACHE)
+
+#define MAXCAPS  32  //  Enable flags shadowed
+#define MAXTEX    4  //  Texture targets shadowed
+#define MAXLIGHT  8  //  Lights shadowed
+
+//  Shadow of one state value
+typedef struct
+{
+   int   valid;
+   GLenum key;     //  Enable cap or texture target
+   float v[4];
+} shadow_t;
+
+static shadow_t caps[MAXCAPS];       //  glEnable/glDisable
+static shadow_t tex[MAXTEX];         //  glBindTexture
+static shadow_t mat[2][5];           //  glMaterial by face and parameter
+static shadow_t light[MAXLIGHT][3];  //  glLight ambient, diffuse, specular
+static shadow_t model[2];            //  glLightModeli
+static shadow_t colormat;            //  glColorMaterial
+static shadow_t color;               //  glColor
+
+static glcount_t count;    //  This frame
+static glcount_t last;     //  Last frame
+static int inside=0;       //  Between glBegin and glEnd (GLCOUNT only)
+static int colorMat=-1;    //  GL_COLOR_MATERIAL on (1), off (0) or unknown
+static int compiling=0;    //  GL_COMPILE display list being built
+static int listing=0;      //  Any display list being built
+static int cache=1;        //  Drop redundant state changes
+
+/*
+ *  Forget all shadowed state
+ */
+static void Invalidate(void)
+{
+   memset(caps,0,sizeof(caps));
+   memset(tex,0,sizeof(tex));
+   memset(mat,0,sizeof(mat));
+   memset(light,0,sizeof(light));
+   memset(model,0,sizeof(model));
+   memset(&colormat,0,sizeof(colormat));
+   memset(&color,0,sizeof(color));
+   colorMat = -1;
+}
+
+/*
+ *  Compare a state value with its shadow and update the shadow
+ *    Returns 1 if the value is already current
+ */
+static int Same(shadow_t* s,const float* v,int n)
+{
+   int k,same;
+   if (compiling) return 0;
+   same = s->valid;
+   for (k=0;k<n;k++)
+   {
+      if (s->v[k]!=v[k]) same = 0;
+      s->v[k] = v[k];
+   }
+   s->valid = 1;
+   return same;
+}
+
+/*
+ *  Count a state change
+ *    Returns 1 if the call should be dropped
+ */
+static int Count(int same)
+{
+   if (compiling) return 0;
+   count.states++;
+   if (!same) return 0;
+   count.redundant++;
+#ifdef GLCACHE
+   if (cache && !listing)
+   {
+      count.skipped++;
+      return 1;
+   }
+#endif
+   return 0;
+}
+
+/*
+ *  Shadow of a state change (NULL s means not shadowed)
+ *    Returns 1 if the call should be dropped
+ */
+static int Set(shadow_t* s,const float* v,int n)
+{
+   return Count(s && Same(s,v,n));
+}
+
+/*
+ *  Shadow slot for a key in a small table (NULL when full)
+ */
+static shadow_t* Slot(shadow_t* table,int n,GLenum key)
+{
+   int k;
+   for (k=0;k<n;k++)
+      if (table[k].valid && table[k].key==key)
+         return table+k;
+   for (k=0;k<n;k++)
+      if (!table[k].valid)
+      {
+         table[k].key = key;
+         return table+k;
+      }
+   return NULL;
+}
+
+/*
+ *  Material parameter index
+ */
+static int Param(GLenum pname)
+{
+   switch (pname)
+   {
+      case GL_AMBIENT:   return 0;
+      case GL_DIFFUSE:   return 1;
+      case GL_SPECULAR:  return 2;
+      case GL_EMISSION:  return 3;
+      case GL_SHININESS: return 4;
+   }
+   return -1;
+}
+
+/*
+ *  Frame counters
+ */
+void GLCountFrame(void)
+{
+   last = count;
+   memset(&count,0,sizeof(count));
+}
+
+const glcount_t* GLCounts(void)
+{
+   return &last;
+}
+
+/*
+ *  Turn dropping redundant state changes on or off
+ */
+void GLCache(int on)
+{
+   cache = on;
+}
+
+#ifdef GLCOUNT
+/*
+ *  Drawing
+ */
+void GLWBegin(GLenum mode)
+{
+   if (!compiling) count.draws++;
+   inside = 1;
+   glBegin(mode);
+}
+
+void GLWEnd(void)
+{
+   inside = 0;
+   glEnd();
+}
+
+void GLWRecti(GLint x1,GLint y1,GLint x2,GLint y2)
+{
+   if (!compiling)
+   {
+      count.draws++;
+      count.vertices += 4;
+   }
+   glRecti(x1,y1,x2,y2);
+}
+
+void GLWVertex2d(GLdouble x,GLdouble y)
+{
+   if (!compiling) count.vertices++;
+   glVertex2d(x,y);
+}
+
+void GLWVertex3d(GLdouble x,GLdouble y,GLdouble z)
+{
+   if (!compiling) count.vertices++;
+   glVertex3d(x,y,z);
+}
+
+void GLWVertex3f(GLfloat x,GLfloat y,GLfloat z)
+{
+   if (!compiling) count.vertices++;
+   glVertex3f(x,y,z);
+}
+
+void GLWVertex3fv(const GLfloat* v)
+{
+   if (!compiling) count.vertices++;
+   glVertex3fv(v);
+}
+
+void GLWVertex3dv(const GLdouble* v)
+{
+   if (!compiling) count.vertices++;
+   glVertex3dv(v);
+}
+
+#endif
+
+/*
+ *  Display lists
+ */
+void GLWNewList(GLuint list,GLenum mode)
+{
+   compiling = (mode==GL_COMPILE);
+   listing = 1;
+   glNewList(list,mode);
+}
+
+void GLWEndList(void)
+{
+   compiling = listing = 0;
+   glEndList();
+}
+
+void GLWCallList(GLuint list)
+{
+   if (!compiling)
+   {
+      count.draws++;
+      //  The list may change any state
+      Invalidate();
+   }
+   glCallList(list);
+}
+
+/*
+ *  Restoring attributes may change any state
+ */
+void GLWPopAttrib(void)
+{
+   if (!compiling) Invalidate();
+   glPopAttrib();
+}
+
+static void Track(void);
+
+/*
+ *  State changes
+ */
+void GLWEnable(GLenum cap)
+{
+   float on=1;
+   if (Set(Slot(caps,MAXCAPS,cap),&on,1)) return;
+   glEnable(cap);
+   if (cap==GL_COLOR_MATERIAL && !compiling)
+   {
+      colorMat = 1;
+      Track();
+   }
+}
+
+void GLWDisable(GLenum cap)
+{
+   float off=0;
+   if (Set(Slot(caps,MAXCAPS,cap),&off,1)) return;
+   glDisable(cap);
+   if (cap==GL_COLOR_MATERIAL && !compiling) colorMat = 0;
+}
+
+void GLWBindTexture(GLenum target,GLuint texture)
+{
+   float t = texture;
+   if (Set(Slot(tex,MAXTEX,target),&t,1)) return;
+   glBindTexture(target,texture);
+}
+
+void GLWDeleteTextures(GLsizei n,const GLuint* textures)
+{
+   //  Deleting the bound texture binds 0
+   if (!compiling) memset(tex,0,sizeof(tex));
+   glDeleteTextures(n,textures);
+}
+
+/*
+ *  Shadow one material face
+ */
+static int Material(int face,GLenum pname,const GLfloat* v)
+{
+   int k = Param(pname);
+   if (pname==GL_AMBIENT_AND_DIFFUSE)
+      return Material(face,GL_AMBIENT,v) & Material(face,GL_DIFFUSE,v);
+   //  Unknown parameters are never redundant
+   else if (k<0)
+      return 0;
+   else
+      return Same(mat[face]+k,v,pname==GL_SHININESS?1:4);
+}
+
+/*
+ *  Color material copies the current color to the material
+ *    Returns 1 if that leaves the material unchanged
+ */
+static int ColorToMaterial(const float* v)
+{
+   int face,same=1;
+   if (compiling) return 0;
+   if (colorMat==0) return 1;
+   //  Which parameters follow the color is unknown
+   if (!colormat.valid)
+   {
+      memset(mat,0,sizeof(mat));
+      return 0;
+   }
+   for (face=0;face<2;face++)
+      if ((face==0 && colormat.v[0]!=GL_BACK) || (face==1 && colormat.v[0]!=GL_FRONT))
+         same &= Material(face,(GLenum)colormat.v[1],v);
+   return same;
+}
+
+/*
+ *  Enabling or changing color material copies the current color
+ */
+static void Track(void)
+{
+   if (color.valid)
+      ColorToMaterial(color.v);
+   else if (!compiling)
+      memset(mat,0,sizeof(mat));
+}
+
+void GLWMaterialfv(GLenum face,GLenum pname,const GLfloat* params)
+{
+   int same = 1;
+   if (face!=GL_BACK)  same &= Material(0,pname,params);
+   if (face!=GL_FRONT) same &= Material(1,pname,params);
+   if (Count(same)) return;
+   glMaterialfv(face,pname,params);
+}
+
+void GLWMaterialf(GLenum face,GLenum pname,GLfloat param)
+{
+   GLWMaterialfv(face,pname,&param);
+}
+
+void GLWLightfv(GLenum lt,GLenum pname,const GLfloat* params)
+{
+   int k = lt-GL_LIGHT0;
+   int p = pname==GL_AMBIENT ? 0 : pname==GL_DIFFUSE ? 1 : pname==GL_SPECULAR ? 2 : -1;
+   //  Positions depend on the modelview matrix so they are never redundant
+   if (Set(k<0 || k>=MAXLIGHT || p<0 ? NULL : light[k]+p,params,4)) return;
+   glLightfv(lt,pname,params);
+}
+
+void GLWLightModeli(GLenum pname,GLint param)
+{
+   float v = param;
+   int k = pname==GL_LIGHT_MODEL_LOCAL_VIEWER ? 0 : pname==GL_LIGHT_MODEL_TWO_SIDE ? 1 : -1;
+   if (Set(k<0 ? NULL : model+k,&v,1)) return;
+   glLightModeli(pname,param);
+}
+
+void GLWColorMaterial(GLenum face,GLenum mode)
+{
+   float v[2] = {face,mode};
+   if (Set(&colormat,v,2)) return;
+   glColorMaterial(face,mode);
+   Track();
+}
+
+void GLWColor3f(GLfloat r,GLfloat g,GLfloat b)
+{
+   float v[4] = {r,g,b,1};
+   int same = Same(&color,v,4);
+   //  With color material the color is redundant only if the material is too
+   same &= ColorToMaterial(v);
+   //  Per vertex colors are not state changes
+   if (!inside && Count(same)) return;
+   glColor3f(r,g,b);
+}
+#endif
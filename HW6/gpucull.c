@@ -0,0 +1,407 @@
+/*
+ *  GPU driven culling and drawing of plain cubes from the object store
+ *
+ *  The bounding spheres, positions and sizes of the objects live in a
+ *  shader storage buffer.  Each frame a compute shader tests every
+ *  object against the view frustum and appends the ones in view to the
+ *  instance list of their texture, counting them in the instance count
+ *  of that texture's indirect draw command.  A loop then calls
+ *  glDrawElementsIndirect once per texture with that texture bound,
+ *  rather than one glMultiDrawElementsIndirect for all of them, so each
+ *  fragment samples one texture.  The number of OpenGL calls per frame
+ *  does not depend on the number of objects and nothing is read back.
+ *  The triangle count for the overlay comes from a
+ *  GL_PRIMITIVES_GENERATED query read a few frames later without
+ *  waiting.
+ *
+ *  The vertex shader lights the cubes like the fixed function pipeline
+ *  does with GL_LIGHT0, color material and white specular, so they
+ *  match the cubes drawn by the render queue.
+ *
+ *  Needs OpenGL 4.4 (compute shaders, indirect draws and multi bind);
+ *  GpuCullCreate returns NULL without it.
+ */
+#include "CSCIx229.h"
+
+//  Apple and Windows headers only declare OpenGL 4 as extensions
+#if (defined(__APPLE__) || defined(_WIN32)) && !defined(USEGLEW)
+#define NOGPUCULL
+#endif
+
+#define MAXTEX 8   //  Textures (one draw command each)
+#define GROUP  64  //  Compute shader work group size
+#define PRIMS  4   //  Primitive count queries in flight
+
+#ifndef NOGPUCULL
+//  Object as the shaders see it
+typedef struct
+{
+   float sphere[4];  //  Bounding sphere center and radius
+   float pos[4];     //  Position and texture slot
+   float size[4];    //  Size along each axis
+} object_t;
+
+//  glDrawElementsIndirect command
+typedef struct
+{
+   GLuint count;
+   GLuint instances;
+   GLuint first;
+   GLint  base;
+   GLuint baseInstance;
+} command_t;
+
+struct gpucull_t
+{
+   int       n;                //  Objects
+   int       ntex;             //  Textures
+   GLuint    tex[MAXTEX];
+   command_t cmd[MAXTEX];      //  Commands with no instances
+   GLuint    objects;          //  Object buffer
+   GLuint    commands;         //  Draw commands
+   GLuint    visible;          //  Objects in view by texture
+   GLuint    mesh[2];          //  Cube vertexes and indexes
+   GLuint    vao;
+   GLuint    cull,draw;        //  Programs
+   GLint     planes,count;     //  Cull uniforms
+   GLint     lighting,local,shiny,emission;  //  Draw uniforms
+   GLuint    prims[PRIMS];     //  Triangles drawn by recent frames
+   int       frame;
+   int       triangles;        //  Triangles drawn PRIMS frames ago
+};
+
+//  Frustum test and append
+static const char* CullShader =
+   "#version 430\n"
+   "layout(local_size_x=64) in;\n"
+   "struct Object {vec4 sphere; vec4 pos; vec4 size;};\n"
+   "struct Command {uint count,instances,first; int base; uint baseInstance;};\n"
+   "layout(std430,binding=0) readonly buffer Objects {Object obj[];};\n"
+   "layout(std430,binding=1) buffer Commands {Command cmd[];};\n"
+   "layout(std430,binding=2) writeonly buffer Visible {uint visible[];};\n"
+   "uniform vec4 plane[6];\n"
+   "uniform uint n;\n"
+   "void main()\n"
+   "{\n"
+   "   uint i = gl_GlobalInvocationID.x;\n"
+   "   if (i>=n) return;\n"
+   "   vec4 s = obj[i].sphere;\n"
+   "   for (int k=0;k<6;k++)\n"
+   "      if (dot(plane[k].xyz,s.xyz)+plane[k].w < -s.w) return;\n"
+   "   uint t = uint(obj[i].pos.w);\n"
+   "   uint j = atomicAdd(cmd[t].instances,1u);\n"
+   "   visible[cmd[t].baseInstance+j] = i;\n"
+   "}\n";
+
+//  Unit cube scaled and moved to the object, lit per vertex
+static const char* VertexShader =
+   "#version 430 compatibility\n"
+   "layout(location=0) in vec3 vertex;\n"
+   "layout(location=1) in vec3 normal;\n"
+   "layout(location=2) in vec2 uv;\n"
+   "layout(location=3) in uint id;\n"
+   "struct Object {vec4 sphere; vec4 pos; vec4 size;};\n"
+   "layout(std430,binding=0) readonly buffer Objects {Object obj[];};\n"
+   "uniform bool  lighting,local;\n"
+   "uniform float shiny;\n"
+   "uniform vec3  emission;\n"
+   "out vec4 color;\n"
+   "out vec2 st;\n"
+   "void main()\n"
+   "{\n"
+   "   Object o = obj[id];\n"
+   "   vec4 P = gl_ModelViewMatrix*vec4(o.pos.xyz+o.size.xyz*vertex,1);\n"
+   "   vec3 N = normalize(gl_NormalMatrix*(normal/o.size.xyz));\n"
+   "   gl_Position = gl_ProjectionMatrix*P;\n"
+   "   st = uv;\n"
+   "   color = vec4(1);\n"
+   "   if (lighting)\n"
+   "   {\n"
+   "      vec4  Lp = gl_LightSource[0].position;\n"
+   "      vec3  L  = normalize(Lp.w==0.0 ? Lp.xyz : Lp.xyz-P.xyz);\n"
+   "      vec3  V  = local ? normalize(-P.xyz) : vec3(0,0,1);\n"
+   "      float d  = max(dot(N,L),0.0);\n"
+   "      float s  = d>0.0 ? (shiny>0.0 ? pow(max(dot(N,normalize(L+V)),0.0),shiny) : 1.0) : 0.0;\n"
+   "      color.rgb = min(emission + gl_LightModel.ambient.rgb + gl_LightSource[0].ambient.rgb\n"
+   "                      + d*gl_LightSource[0].diffuse.rgb + s*gl_LightSource[0].specular.rgb,1.0);\n"
+   "   }\n"
+   "}\n";
+
+//  Texture of the draw, modulated by the lit color
+static const char* FragmentShader =
+   "#version 430\n"
+   "uniform sampler2D tex;\n"
+   "in vec4 color;\n"
+   "in vec2 st;\n"
+   "out vec4 frag;\n"
+   "void main()\n"
+   "{\n"
+   "   frag = color*texture(tex,st);\n"
+   "}\n";
+
+/*
+ *  Compile a shader
+ */
+static GLuint Shader(GLenum type,const char* text)
+{
+   char   log[4096];
+   GLint  ok;
+   GLuint shader = glCreateShader(type);
+   glShaderSource(shader,1,&text,NULL);
+   glCompileShader(shader);
+   glGetShaderiv(shader,GL_COMPILE_STATUS,&ok);
+   if (!ok)
+   {
+      glGetShaderInfoLog(shader,sizeof(log),NULL,log);
+      Fatal("Cannot compile GPU culling shader:\n%s\n",log);
+   }
+   return shader;
+}
+
+/*
+ *  Link a program from two shaders (or one if fs is NULL)
+ */
+static GLuint Program(GLenum type,const char* text,const char* fs)
+{
+   char   log[4096];
+   GLint  ok;
+   GLuint prog = glCreateProgram();
+   GLuint s0 = Shader(type,text);
+   GLuint s1 = fs ? Shader(GL_FRAGMENT_SHADER,fs) : 0;
+   glAttachShader(prog,s0);
+   if (s1) glAttachShader(prog,s1);
+   glLinkProgram(prog);
+   glGetProgramiv(prog,GL_LINK_STATUS,&ok);
+   if (!ok)
+   {
+      glGetProgramInfoLog(prog,sizeof(log),NULL,log);
+      Fatal("Cannot link GPU culling program:\n%s\n",log);
+   }
+   glDeleteShader(s0);
+   if (s1) glDeleteShader(s1);
+   return prog;
+}
+
+/*
+ *  Cube from -1 to 1 with the faces, normals and texture coordinates of
+ *  UnitCube
+ */
+static void Mesh(gpucull_t* g)
+{
+   static const float n[6][3] = {{0,0,1},{0,0,-1},{1,0,0},{-1,0,0},{0,1,0},{0,-1,0}};
+   static const float v[6][4][3] =
+   {
+      {{-1,-1, 1},{+1,-1, 1},{+1,+1, 1},{-1,+1, 1}},
+      {{+1,-1,-1},{-1,-1,-1},{-1,+1,-1},{+1,+1,-1}},
+      {{+1,-1,+1},{+1,-1,-1},{+1,+1,-1},{+1,+1,+1}},
+      {{-1,-1,-1},{-1,-1,+1},{-1,+1,+1},{-1,+1,-1}},
+      {{-1,+1,+1},{+1,+1,+1},{+1,+1,-1},{-1,+1,-1}},
+      {{-1,-1,-1},{+1,-1,-1},{+1,-1,+1},{-1,-1,+1}},
+   };
+   static const float st[4][2] = {{0,0},{1,0},{1,1},{0,1}};
+   float  vert[24][8];
+   GLuint index[36];
+   int    f,k;
+   //  Each face is two triangles of its quad
+   for (f=0;f<6;f++)
+   {
+      for (k=0;k<4;k++)
+      {
+         float* p = vert[4*f+k];
+         memcpy(p,v[f][k],3*sizeof(float));
+         memcpy(p+3,n[f],3*sizeof(float));
+         memcpy(p+6,st[k],2*sizeof(float));
+      }
+      index[6*f+0] = 4*f;   index[6*f+1] = 4*f+1; index[6*f+2] = 4*f+2;
+      index[6*f+3] = 4*f;   index[6*f+4] = 4*f+2; index[6*f+5] = 4*f+3;
+   }
+   glGenVertexArrays(1,&g->vao);
+   glBindVertexArray(g->vao);
+   glGenBuffers(2,g->mesh);
+   glBindBuffer(GL_ARRAY_BUFFER,g->mesh[0]);
+   glBufferData(GL_ARRAY_BUFFER,sizeof(vert),vert,GL_STATIC_DRAW);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,g->mesh[1]);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER,sizeof(index),index,GL_STATIC_DRAW);
+   glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,8*sizeof(float),(void*)0);
+   glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,8*sizeof(float),(void*)(3*sizeof(float)));
+   glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,8*sizeof(float),(void*)(6*sizeof(float)));
+   glEnableVertexAttribArray(0);
+   glEnableVertexAttribArray(1);
+   glEnableVertexAttribArray(2);
+   //  The object of each instance comes from the visible list
+   glBindBuffer(GL_ARRAY_BUFFER,g->visible);
+   glVertexAttribIPointer(3,1,GL_UNSIGNED_INT,0,(void*)0);
+   glVertexAttribDivisor(3,1);
+   glEnableVertexAttribArray(3);
+   glBindVertexArray(0);
+   glBindBuffer(GL_ARRAY_BUFFER,0);
+}
+#endif
+
+/*
+ *  Upload objects first to the end of the store for GPU culling
+ *    They must be cubes without a transform graph node
+ *    Returns NULL if the driver cannot do it
+ */
+gpucull_t* GpuCullCreate(const store_t* s,int first)
+{
+#ifdef NOGPUCULL
+   return NULL;
+#else
+   int major=0,minor=0,k,t;
+   int count[MAXTEX]={0};
+   const char* ver = (const char*)glGetString(GL_VERSION);
+   object_t* obj;
+   gpucull_t* g;
+   if (ver) sscanf(ver,"%d.%d",&major,&minor);
+   if (major<4 || (major==4 && minor<4)) return NULL;
+   g = (gpucull_t*)calloc(1,sizeof(gpucull_t));
+   if (!g) Fatal("Cannot allocate GPU culling\n");
+   g->n = s->n-first;
+   if (g->n<=0) g->n = 0;
+
+   //  Texture slots, then the objects of each slot one after another
+   obj = (object_t*)malloc((g->n?g->n:1)*sizeof(object_t));
+   if (!obj) Fatal("Cannot allocate %d GPU culling objects\n",g->n);
+   for (k=first;k<s->n;k++)
+   {
+      if (s->shape[k]!=SHAPE_CUBE || s->node[k]>=0) Fatal("GPU culling only draws plain cubes\n");
+      for (t=0;t<g->ntex && g->tex[t]!=s->texture[k];t++);
+      if (t==g->ntex)
+      {
+         if (t==MAXTEX) Fatal("GPU culling draws at most %d textures\n",MAXTEX);
+         g->tex[g->ntex++] = s->texture[k];
+      }
+      count[t]++;
+      obj[k-first].sphere[0] = s->cx[k];
+      obj[k-first].sphere[1] = s->cy[k];
+      obj[k-first].sphere[2] = s->cz[k];
+      obj[k-first].sphere[3] = s->r[k];
+      obj[k-first].pos[0] = s->x[k];
+      obj[k-first].pos[1] = s->y[k];
+      obj[k-first].pos[2] = s->z[k];
+      obj[k-first].pos[3] = t;
+      obj[k-first].size[0] = s->sx[k];
+      obj[k-first].size[1] = s->sy[k];
+      obj[k-first].size[2] = s->sz[k];
+      obj[k-first].size[3] = 0;
+   }
+   //  Each texture's command draws the 36 indexes of the cube for the
+   //  instances the compute shader appends to its part of the list
+   for (k=t=0;t<g->ntex;t++)
+   {
+      g->cmd[t].count = 36;
+      g->cmd[t].instances = 0;
+      g->cmd[t].first = 0;
+      g->cmd[t].base = 0;
+      g->cmd[t].baseInstance = k;
+      k += count[t];
+   }
+
+   glGenBuffers(1,&g->objects);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,g->objects);
+   glBufferData(GL_SHADER_STORAGE_BUFFER,(g->n?g->n:1)*sizeof(object_t),obj,GL_STATIC_DRAW);
+   glGenBuffers(1,&g->commands);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,g->commands);
+   glBufferData(GL_SHADER_STORAGE_BUFFER,sizeof(g->cmd),g->cmd,GL_DYNAMIC_DRAW);
+   glGenBuffers(1,&g->visible);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,g->visible);
+   glBufferData(GL_SHADER_STORAGE_BUFFER,(g->n?g->n:1)*sizeof(GLuint),NULL,GL_DYNAMIC_DRAW);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,0);
+   free(obj);
+   Mesh(g);
+
+   //  Programs
+   g->cull = Program(GL_COMPUTE_SHADER,CullShader,NULL);
+   g->planes = glGetUniformLocation(g->cull,"plane");
+   g->count  = glGetUniformLocation(g->cull,"n");
+   g->draw = Program(GL_VERTEX_SHADER,VertexShader,FragmentShader);
+   g->lighting = glGetUniformLocation(g->draw,"lighting");
+   g->local    = glGetUniformLocation(g->draw,"local");
+   g->shiny    = glGetUniformLocation(g->draw,"shiny");
+   g->emission = glGetUniformLocation(g->draw,"emission");
+   glGenQueries(PRIMS,g->prims);
+   //  Each draw binds its texture to unit 1 (unit 0 is left to the fixed function)
+   glUseProgram(g->draw);
+   glUniform1i(glGetUniformLocation(g->draw,"tex"),1);
+   glUseProgram(0);
+   return g;
+#endif
+}
+
+/*
+ *  Cull and draw the objects with the current projection and modelview
+ *  and the light parameters of GL_LIGHT0
+ *    plane are the view frustum planes in world coordinates
+ *    lighting and local are the GL_LIGHTING and local viewer settings
+ */
+void GpuCullDraw(gpucull_t* g,const vec4 plane[6],int lighting,int local,float shiny,int emission)
+{
+#ifndef NOGPUCULL
+   GLint ready=0;
+   int   t;
+   GLuint prims;
+   Trace("GpuCullDraw");
+   if (!g->n) return;
+   //  Cull into empty commands
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,g->commands);
+   glBufferSubData(GL_SHADER_STORAGE_BUFFER,0,g->ntex*sizeof(command_t),g->cmd);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,0);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER,0,g->objects);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER,1,g->commands);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER,2,g->visible);
+   glUseProgram(g->cull);
+   glUniform4fv(g->planes,6,(const float*)plane);
+   glUniform1ui(g->count,g->n);
+   glDispatchCompute((g->n+GROUP-1)/GROUP,1,1);
+   glMemoryBarrier(GL_COMMAND_BARRIER_BIT|GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+   //  Draw what is left, one command per texture with it bound
+   glUseProgram(g->draw);
+   glUniform1i(g->lighting,lighting);
+   glUniform1i(g->local,local);
+   glUniform1f(g->shiny,shiny);
+   glUniform3f(g->emission,0,0,0.01*emission);
+   glBindVertexArray(g->vao);
+   glBindBuffer(GL_DRAW_INDIRECT_BUFFER,g->commands);
+   //  Count the triangles, reading the oldest count if it is in
+   prims = g->prims[g->frame%PRIMS];
+   if (g->frame++>=PRIMS)
+   {
+      glGetQueryObjectiv(prims,GL_QUERY_RESULT_AVAILABLE,&ready);
+      if (ready) glGetQueryObjectiv(prims,GL_QUERY_RESULT,&g->triangles);
+   }
+   glBeginQuery(GL_PRIMITIVES_GENERATED,prims);
+   for (t=0;t<g->ntex;t++)
+   {
+      glBindTextures(1,1,g->tex+t);
+      glDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_INT,(void*)(t*sizeof(command_t)));
+   }
+   glEndQuery(GL_PRIMITIVES_GENERATED);
+   PerfDraws(g->ntex,g->triangles);
+   glBindBuffer(GL_DRAW_INDIRECT_BUFFER,0);
+   glBindVertexArray(0);
+   glBindTextures(1,1,NULL);
+   glUseProgram(0);
+#endif
+}
+
+/*
+ *  Objects drawn by the last GpuCullDraw
+ *    Waits for the GPU, so it is for tests (see bench.c), not every frame
+ */
+int GpuCullVisible(gpucull_t* g)
+{
+   int n=0;
+#ifndef NOGPUCULL
+   int t;
+   command_t cmd[MAXTEX];
+   if (!g->ntex) return 0;
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,g->commands);
+   glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,0,g->ntex*sizeof(command_t),cmd);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER,0);
+   for (t=0;t<g->ntex;t++)
+      n += cmd[t].instances;
+#endif
+   return n;
+}
@@ -0,0 +1,101 @@
+/*
+ *  Transform hierarchy
+ *
+ *  Each node has a local matrix relative to its parent and a cached
+ *  world matrix.  A node's parent is always added before it, so the
+ *  nodes are stored in topological order in contiguous arrays and one
+ *  pass from the first changed node updates every world matrix that
+ *  depends on a change.  GraphLocal marks a node dirty; GraphUpdate
+ *  recomputes the dirty nodes and their descendants and nothing else, so
+ *  a hierarchy where nothing moved costs no matrix work at all.
+ *
+ *  A graph makes no OpenGL calls and may be used on any one thread.
+ */
+#include "CSCIx229.h"
+
+struct graph_t
+{
+   int*           parent;   //  Parent node (-1 for a root)
+   mat4*          local;    //  Relative to the parent
+   mat4*          world;    //  Cached parent world * local
+   unsigned char* dirty;    //  Local changed or parent recomputed
+   int            Nnodes,Mnodes;
+   int            first;    //  First dirty node (Nnodes if none)
+};
+
+/*
+ *  New empty graph
+ */
+graph_t* GraphCreate(void)
+{
+   graph_t* g = (graph_t*)calloc(1,sizeof(graph_t));
+   if (!g) Fatal("Cannot allocate transform graph\n");
+   return g;
+}
+
+/*
+ *  Add a node under parent (-1 for a root)
+ *    Returns the node
+ */
+int GraphAdd(graph_t* g,int parent,const mat4 local)
+{
+   int k = g->Nnodes;
+   if (parent<-1 || parent>=k) Fatal("Transform graph parent %d does not exist\n",parent);
+   if (k==g->Mnodes)
+   {
+      g->Mnodes = g->Mnodes ? 2*g->Mnodes : 64;
+      g->parent = (int*)realloc(g->parent,g->Mnodes*sizeof(int));
+      g->local = (mat4*)realloc(g->local,g->Mnodes*sizeof(mat4));
+      g->world = (mat4*)realloc(g->world,g->Mnodes*sizeof(mat4));
+      g->dirty = (unsigned char*)realloc(g->dirty,g->Mnodes);
+      if (!g->parent || !g->local || !g->world || !g->dirty) Fatal("Cannot allocate %d transform nodes\n",g->Mnodes);
+   }
+   g->parent[k] = parent;
+   g->Nnodes++;
+   GraphLocal(g,k,local);
+   return k;
+}
+
+/*
+ *  Set the local matrix of a node
+ */
+void GraphLocal(graph_t* g,int node,const mat4 local)
+{
+   memcpy(g->local[node],local,sizeof(mat4));
+   g->dirty[node] = 1;
+   if (node<g->first) g->first = node;
+}
+
+/*
+ *  Recompute the world matrixes that are out of date
+ *    Returns the number of nodes recomputed
+ */
+int GraphUpdate(graph_t* g)
+{
+   int k,n=0;
+   Trace("GraphUpdate");
+   for (k=g->first;k<g->Nnodes;k++)
+   {
+      int p = g->parent[k];
+      if (p>=0 && g->dirty[p]) g->dirty[k] = 1;
+      if (!g->dirty[k]) continue;
+      if (p<0)
+         memcpy(g->world[k],g->local[k],sizeof(mat4));
+      else
+         Mat4Multiply(g->world[k],g->world[p],g->local[k]);
+      n++;
+   }
+   //  Flags are cleared afterwards so children still see their parent's
+   for (k=g->first;k<g->Nnodes;k++)
+      g->dirty[k] = 0;
+   g->first = g->Nnodes;
+   return n;
+}
+
+/*
+ *  World matrix of a node as of the last GraphUpdate
+ */
+const float* GraphWorld(const graph_t* g,int node)
+{
+   return g->world[node];
+}
@@ -0,0 +1,317 @@
+/*
+ *  Headless benchmark mode
+ *
+ *  Command line options (removed from argv):
+ *    -headless N       render N frames offscreen and print timings
+ *    -warmup K         frames rendered before timing starts (default 2)
+ *    -size WxH         framebuffer size (default 600x600)
+ *    -snapshot file    write the last frame as a binary PPM
+ */
+#define HEADLESS_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include "headless.h"
+//  Trace zones when built into the HW6 library with make TRACE=1
+#ifdef TRACE
+#include "CSCIx229.h"
+#else
+#define Trace(name)
+#endif
+#if !defined(__APPLE__) && !defined(_WIN32)
+#define HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+static int frames=0;                 //  Frames to render (0 = windowed)
+static int frame=0;                  //  Current frame
+static int warmup=2;                 //  Untimed frames (shader compiles etc.)
+static int width=600,height=600;     //  Framebuffer size
+static const char* snapshot=NULL;    //  Snapshot file
+static void (*idleFunc)(void)=NULL;  //  Current idle callback
+static void (*frameFunc)(double)=NULL; //  Called with each timed frame
+
+//  Fixed animation step in milliseconds
+#define FRAME_MS (1000.0/60)
+
+/*
+ *  Remove n arguments starting at k
+ */
+static void Consume(int* argc,char* argv[],int k,int n)
+{
+   int i;
+   for (i=k;i+n<=*argc;i++)
+      argv[i] = argv[i+n];
+   *argc -= n;
+}
+
+#ifdef HEADLESS_EGL
+/*
+ *  Create an OpenGL context with no window and an offscreen framebuffer
+ */
+static int CreateContext(void)
+{
+   EGLDisplay dpy=EGL_NO_DISPLAY;
+   EGLConfig  cfg=NULL;
+   EGLContext ctx;
+   EGLint     major,minor,n=0;
+   GLuint     fbo,rbo[2];
+   const EGLint attr[] = {EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,EGL_NONE};
+   PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+   //  Prefer the Mesa surfaceless platform, which needs no display server
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+   if (getPlatformDisplay)
+      dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+#endif
+   if (dpy==EGL_NO_DISPLAY)
+      dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   if (dpy==EGL_NO_DISPLAY || !eglInitialize(dpy,&major,&minor))
+   {
+      fprintf(stderr,"Cannot initialize EGL\n");
+      return 0;
+   }
+   if (!eglBindAPI(EGL_OPENGL_API))
+   {
+      fprintf(stderr,"EGL does not support OpenGL\n");
+      return 0;
+   }
+   //  Any OpenGL config will do since nothing is drawn to an EGL surface
+   if (!eglChooseConfig(dpy,attr,&cfg,1,&n) || n<1)
+      cfg = NULL;
+   ctx = eglCreateContext(dpy,cfg,EGL_NO_CONTEXT,NULL);
+   if (ctx==EGL_NO_CONTEXT || !eglMakeCurrent(dpy,EGL_NO_SURFACE,EGL_NO_SURFACE,ctx))
+   {
+      fprintf(stderr,"Cannot create surfaceless OpenGL context\n");
+      return 0;
+   }
+
+   //  Color and depth renderbuffers
+   glGenFramebuffers(1,&fbo);
+   glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+   glGenRenderbuffers(2,rbo);
+   glBindRenderbuffer(GL_RENDERBUFFER,rbo[0]);
+   glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,width,height);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,rbo[0]);
+   glBindRenderbuffer(GL_RENDERBUFFER,rbo[1]);
+   glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH24_STENCIL8,width,height);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_STENCIL_ATTACHMENT,GL_RENDERBUFFER,rbo[1]);
+   if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+   {
+      fprintf(stderr,"Offscreen framebuffer incomplete\n");
+      return 0;
+   }
+   glDrawBuffer(GL_COLOR_ATTACHMENT0);
+   glReadBuffer(GL_COLOR_ATTACHMENT0);
+   return 1;
+}
+#endif
+
+/*
+ *  Check for headless options and create the offscreen context
+ *    Returns 1 in headless mode, otherwise 0 and the GLUT window is used
+ */
+int Headless(int* argc,char* argv[])
+{
+   int k=1;
+   while (k<*argc)
+   {
+      if (!strcmp(argv[k],"-headless") && k+1<*argc)
+      {
+         frames = atoi(argv[k+1]);
+         Consume(argc,argv,k,2);
+      }
+      else if (!strcmp(argv[k],"-warmup") && k+1<*argc)
+      {
+         warmup = atoi(argv[k+1]);
+         if (warmup<0) warmup = 0;
+         Consume(argc,argv,k,2);
+      }
+      else if (!strcmp(argv[k],"-size") && k+1<*argc)
+      {
+         if (sscanf(argv[k+1],"%dx%d",&width,&height)!=2 || width<1 || height<1)
+         {
+            fprintf(stderr,"Invalid size %s\n",argv[k+1]);
+            exit(1);
+         }
+         Consume(argc,argv,k,2);
+      }
+      else if (!strcmp(argv[k],"-snapshot") && k+1<*argc)
+      {
+         snapshot = argv[k+1];
+         Consume(argc,argv,k,2);
+      }
+      else
+         k++;
+   }
+   if (frames<1)
+   {
+      frames = 0;
+      return 0;
+   }
+#ifdef HEADLESS_EGL
+   if (!CreateContext()) exit(1);
+#else
+   fprintf(stderr,"Headless mode needs EGL\n");
+   exit(1);
+#endif
+   return 1;
+}
+
+/*
+ *  Elapsed time in ms
+ */
+static double Now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return 1e3*ts.tv_sec + 1e-6*ts.tv_nsec;
+}
+
+static int CompareDouble(const void* a,const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x>y) - (x<y);
+}
+
+/*
+ *  Write the framebuffer as a binary PPM
+ */
+static void WriteSnapshot(const char* file)
+{
+   int j;
+   FILE* f = fopen(file,"wb");
+   unsigned char* rgb = (unsigned char*)malloc(3*width*height);
+   if (!f || !rgb)
+   {
+      fprintf(stderr,"Cannot write snapshot %s\n",file);
+      if (f) fclose(f);
+      free(rgb);
+      return;
+   }
+   glPixelStorei(GL_PACK_ALIGNMENT,1);
+   glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE,rgb);
+   fprintf(f,"P6\n%d %d\n255\n",width,height);
+   //  PPM rows go top to bottom
+   for (j=height-1;j>=0;j--)
+      fwrite(rgb+3*width*j,3,width,f);
+   fclose(f);
+   free(rgb);
+}
+
+/*
+ *  Render the frames and print the timing results
+ */
+int HeadlessRun(void (*display)(void),void (*reshape)(int,int),void (*idle)(void))
+{
+   double* ms = (double*)malloc(frames*sizeof(double));
+   double  sum=0,t0=0;
+   if (!ms)
+   {
+      fprintf(stderr,"Cannot allocate %d frame times\n",frames);
+      return 1;
+   }
+   idleFunc = idle;
+   reshape(width,height);
+   for (frame=0;frame<warmup+frames;frame++)
+   {
+      double t = Now();
+      if (frame==warmup) t0 = t;
+      if (idleFunc) idleFunc();
+      display();
+      //  Include the GPU work in the frame time
+      {
+         Trace("glFinish");
+         glFinish();
+      }
+      if (frame>=warmup)
+      {
+         ms[frame-warmup] = Now()-t;
+         sum += ms[frame-warmup];
+         if (frameFunc) frameFunc(ms[frame-warmup]);
+      }
+   }
+   t0 = Now()-t0;
+   if (snapshot) WriteSnapshot(snapshot);
+
+   qsort(ms,frames,sizeof(double),CompareDouble);
+   printf("Renderer %s (%s)\n",(char*)glGetString(GL_RENDERER),(char*)glGetString(GL_VERSION));
+   printf("%d frames %dx%d in %.3f s = %.3f FPS (after %d warmup frames)\n",frames,width,height,t0/1000,1000*frames/t0,warmup);
+   printf("Frame ms: mean %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n",sum/frames,
+      ms[(int)ceil(0.50*frames)-1],ms[(int)ceil(0.95*frames)-1],ms[(int)ceil(0.99*frames)-1],ms[frames-1]);
+   printf("{\"frames\": %d, \"width\": %d, \"height\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}\n",
+      frames,width,height,sum/frames,
+      ms[(int)ceil(0.50*frames)-1],ms[(int)ceil(0.95*frames)-1],ms[(int)ceil(0.99*frames)-1],ms[frames-1]);
+   free(ms);
+   return 0;
+}
+
+/*
+ *  GLUT replacements
+ */
+void HeadlessSwapBuffers(void)
+{
+   Trace("SwapBuffers");
+   if (!frames) glutSwapBuffers();
+}
+
+int HeadlessGet(GLenum what)
+{
+   if (!frames)
+      return glutGet(what);
+   else if (what==GLUT_ELAPSED_TIME)
+      return (int)(frame*FRAME_MS);
+   else if (what==GLUT_WINDOW_WIDTH)
+      return width;
+   else if (what==GLUT_WINDOW_HEIGHT)
+      return height;
+   return 0;
+}
+
+void HeadlessPostRedisplay(void)
+{
+   if (!frames) glutPostRedisplay();
+}
+
+void HeadlessIdleFunc(void (*idle)(void))
+{
+   if (frames)
+      idleFunc = idle;
+   else
+      glutIdleFunc(idle);
+}
+
+//  Bitmap fonts need GLUT, so text is skipped in headless mode
+void HeadlessBitmapCharacter(void* font,int ch)
+{
+   if (!frames) glutBitmapCharacter(font,ch);
+}
+
+int HeadlessBitmapWidth(void* font,int ch)
+{
+   return frames ? 0 : glutBitmapWidth(font,ch);
+}
+
+void HeadlessDestroyWindow(int win)
+{
+   if (!frames) glutDestroyWindow(win);
+}
+
+/*
+ *  Report each timed frame (ms) to the caller, e.g. for per-segment stats
+ */
+void HeadlessFrameFunc(void (*frame)(double ms))
+{
+   frameFunc = frame;
+}
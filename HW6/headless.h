@@ -0,0 +1,47 @@
+/*
+ *  Headless benchmark mode
+ *
+ *  With -headless N on the command line the program renders N frames
+ *  into an offscreen framebuffer through EGL (Mesa llvmpipe works)
+ *  instead of opening a GLUT window, then prints frame time statistics.
+ *  Animation time advances by a fixed 1/60 s per frame, so every run
+ *  draws exactly the same frames.
+ *
+ *  Include this after the GLUT header.  It routes the GLUT calls that
+ *  the programs make while drawing to versions that also work without
+ *  a window.  Every assignment builds this one copy (see headless.c);
+ *  CSCIx229.h includes it for HW6.
+ */
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int  Headless(int* argc,char* argv[]);
+int  HeadlessRun(void (*display)(void),void (*reshape)(int,int),void (*idle)(void));
+void HeadlessSwapBuffers(void);
+int  HeadlessGet(GLenum what);
+void HeadlessPostRedisplay(void);
+void HeadlessIdleFunc(void (*idle)(void));
+void HeadlessBitmapCharacter(void* font,int ch);
+int  HeadlessBitmapWidth(void* font,int ch);
+void HeadlessDestroyWindow(int win);
+void HeadlessFrameFunc(void (*frame)(double ms));
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef HEADLESS_IMPL
+#define glutSwapBuffers()        HeadlessSwapBuffers()
+#define glutGet(what)            HeadlessGet(what)
+#define glutPostRedisplay()      HeadlessPostRedisplay()
+#define glutIdleFunc(idle)       HeadlessIdleFunc(idle)
+#define glutBitmapCharacter(f,c) HeadlessBitmapCharacter(f,c)
+#define glutBitmapWidth(f,c)     HeadlessBitmapWidth(f,c)
+#define glutDestroyWindow(win)   HeadlessDestroyWindow(win)
+#endif
+
+#endif
@@ -23,7 +23,22 @@
  *  arrows     Change view angle
  *  []         Zoom in and out
  *  0          Reset view angle
+ *  k          Append the current view to camera.path as a keyframe
+ *  o          Toggle performance overlay
+ *  c          Toggle redundant state filtering (built with GLCACHE)
  *  ESC        Exit
+ *
+ *  Command line:
+ *  -path file    Fly the camera along a keyframed path and report frame
+ *                times for each segment of the path (see campath.c)
+ *  -record file  Record key presses with their times
+ *  -play file    Play back recorded key presses
+ *  -trace file   Write a Chrome trace of the run (build with make TRACE=1)
+ *  -jobs N       Job system worker threads (default cores-1)
+ *  -fps N        Redraw at most N times a second (default 120)
+ *  -city N       Add N plain buildings behind the skyline
+ *  -cull gpu     Cull and draw those buildings on the GPU (default cpu)
+ *  -occlude off  Do not skip objects hidden behind nearer buildings
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,434 +53,426 @@
 #endif
 #include "CSCIx229.h"
 
-int th=0;         //  Azimuth of view angle
-int ph=0;         //  Elevation of view angle
-int axes=1;       //  Display axes
-int mode=0;       //  Projection mode
-int fov=58;       //  Field of view (for perspective)
-double asp=1;     //  Aspect ratio
-double dim=3.0;   //  Size of world
-int light=1;      //  Lighting
-int move=1;       //  Move light
-
-double MX = 0;
-double MY = 0;
-double MZ = 0;
-double EX = 0;
-double EY = 0;
-double EZ = 5.2;
-
-// Light values
-int one       =   1;  // Unit value
-int distance  =   3;  // Light distance
-int inc       =  10;  // Ball increment
-int smooth    =   1;  // Smooth/Flat shading
-int local     =   0;  // Local Viewer Model
-int emission  =   0;  // Emission intensity (%)
-int ambient   =  30;  // Ambient intensity (%)
-int diffuse   = 100;  // Diffuse intensity (%)
-int specular  =   0;  // Specular intensity (%)
-int shininess =   0;  // Shininess (power of two)
-float shiny   =   1;  // Shininess (value)
-int zh        =  90;  // Light azimuth
-float ylight  =   1;  // Elevation of light
+//  Scene state, written by the simulation and drawn by the renderer
+typedef struct
+{
+   int th;            //  Azimuth of view angle
+   int ph;            //  Elevation of view angle
+   double vth,vph;    //  View angles drawn (set by the camera path)
+   int axes;          //  Display axes
+   int mode;          //  Projection mode
+   int fov;           //  Field of view (for perspective)
+   double dim;        //  Size of world
+   int light;         //  Lighting
+   int move;          //  Move light
+   double EX,EY,EZ;   //  Eye position (first person)
+   int path;          //  Camera path playing
+   int overlay;       //  Performance overlay
+   int cache;         //  Drop redundant state changes (GLCACHE builds)
+   int quit;          //  Exit requested
+   // Light values
+   int one;           // Unit value
+   int distance;      // Light distance
+   int inc;           // Ball increment
+   int smooth;        // Smooth/Flat shading
+   int local;         // Local Viewer Model
+   int emission;      // Emission intensity (%)
+   int ambient;       // Ambient intensity (%)
+   int diffuse;       // Diffuse intensity (%)
+   int specular;      // Specular intensity (%)
+   int shininess;     // Shininess (power of two)
+   float shiny;       // Shininess (value)
+   int zh;            // Light azimuth
+   float ylight;      // Elevation of light
+   unsigned version;  //  Counts steps that changed the scene
+} state_t;
+
+//  Simulation copy of the scene (only touched by simulate)
+state_t sim =
+{
+   .th=0, .ph=0, .axes=1, .mode=0, .fov=58, .dim=3.0, .light=1, .move=1,
+   .EX=0, .EY=0, .EZ=5.2, .path=0, .overlay=0, .cache=1, .quit=0,
+   .one=1, .distance=3, .inc=10, .smooth=1, .local=0, .emission=0,
+   .ambient=30, .diffuse=100, .specular=0, .shininess=0, .shiny=1,
+   .zh=90, .ylight=1,
+};
+double pathStart=-1;   //  Time the path started (s)
+state_t last;          //  Scene at the last change
+
+//  Snapshots passed from the simulation to the renderer
+state_t snapshot[3];
+triple_t scene;
+const state_t* S;      //  Snapshot being drawn
+
+double asp=1;        //  Aspect ratio
+int height=600;      //  Window height (pixels)
+int path=0;          //  Camera path frame times being recorded
+int lastFrame=-1;    //  Time of the previous frame (ms)
+int headless=0;      //  Offscreen benchmark
+int fps=120;         //  Redraw rate cap
+int stale=1;         //  Frame being prepared differs from the one drawn
+int ticking=0;       //  Redraw timer armed
+void wake();
+int city=0;          //  Plain buildings added behind the skyline
+int gpuCull=0;       //  Cull and draw the city on the GPU
+int occlude=1;       //  Skip objects hidden behind nearer buildings
 
 unsigned int texture[9];  //  Textures
+const char* textures[9] = {"shinyMetal.bmp","building1.bmp","concrete.bmp","cylinder.bmp","building.bmp",
+                           "stainGlass.bmp","glass.bmp","buildingWindow.bmp","louvre.bmp"};
+
+//  Skyline groups placed as one (objects in a group are positioned
+//  relative to its origin)
+enum {NOGROUP,TOWER,SCULPTURE,ANNEX};
+double groups[][3] = {{0,0,0},{-0.65,0,-1},{1.95,0,0.5},{1,0,-0.75}};
+#define NGROUP (int)(sizeof(groups)/sizeof(groups[0]))
+
+//  Skyline object
+typedef struct
+{
+   int    shape;     //  SHAPE_CUBE etc.
+   int    tex;       //  Index into texture[]
+   double p[6];      //  Shape position and size
+   int    group;     //  Group it belongs to
+} object_t;
+
+//  Chicago Skyline (the cubes turn with the view azimuth)
+object_t skyline[] =
+{
+   // dark buildings
+   {SHAPE_CUBE, 1, {-1.75, .6, -.2, 0.22, 0.6, 0.2}},
+   {SHAPE_CUBE, 1, {-1.25, .9, -1, 0.15, 0.9, 0.2}},
+   {SHAPE_CUBE, 1, {1.1, .75, -.2, 0.08, 0.75, 0.2}},
+   {SHAPE_CUBE, 1, {1.45, .6, -.2, 0.15, 0.6, 0.2}},
+   {SHAPE_CUBE, 1, {1.8, .6, -.2, 0.1, 0.6, 0.2}},
+   {SHAPE_CUBE, 1, {1, .7, -.2, 0.08, 0.7, 0.2}},
+
+   // light building
+   {SHAPE_CUBE, 4, {-1.65, .3, -1, 0.35, 0.3, 0.2}},
+   {SHAPE_CUBE, 4, {-2.25, .35, -.2, 0.2, 0.35, 0.2}},
+   {SHAPE_CUBE, 4, {-1, .7, -1, 0.15, 0.7, 0.2}},
+   {SHAPE_CUBE, 4, {-0.7, .3, -1, 0.25, 0.3, 0.2}},
+   {SHAPE_CUBE, 4, {-0.65, .65, -1, 0.13, 0.05, 0.1}, TOWER},
+   {SHAPE_CUBE, 4, {-0.65, .65, -1, 0.08, 0.3, 0.1}, TOWER},
+   {SHAPE_CUBE, 4, {-0.65, .95, -1, 0.05, 0.15, 0.1}, TOWER},
+   {SHAPE_CUBE, 4, {0.95, .3, -.75, 0.1, 0.3, 0.1}, ANNEX},
+   {SHAPE_CUBE, 4, {0.95, .1, -.75, 0.3, 0.1, 0.1}, ANNEX},
+   {SHAPE_CUBE, 4, {1.1, .4, -.75, 0.15, 0.4, 0.1}, ANNEX},
+   {SHAPE_CUBE, 4, {0.7, .5, -.2, 0.1, 0.5, 0.2}},
+
+   // shiny metal
+   {SHAPE_HALFTORUS, 0, {-.15, 0, .2, 8, 26, .25}},
+
+   // windows
+   {SHAPE_TETRAHEDRON, 6, {0.15, .8, -.2, .1, .2, .2}},
+   {SHAPE_TETRAHEDRON, 6, {0.45, .8, -.2, .1, .2, .2}},
+   {SHAPE_TETRAHEDRON, 6, {0.7, 1.1, -.2, .1, .12, .12}},
+   {SHAPE_TETRAHEDRON, 6, {1.85, .5, .5, .1, .1, .12}, SCULPTURE},
+   {SHAPE_TETRAHEDRON, 6, {2.05, .8, .5, .1, .2, .12}, SCULPTURE},
+
+   // stain glass
+   {SHAPE_CUBE, 5, {2.05, .3, .5, 0.1, 0.3, 0.1}, SCULPTURE},
+   {SHAPE_CUBE, 5, {1.85, .3, .5, 0.1, 0.1, 0.1}, SCULPTURE},
+
+   // Louvre
+   {SHAPE_CUBE, 8, {-2.25, .15, .5, 0.15, 0.15, 0.15}},
+
+   // concrete
+   {SHAPE_SPHERE, 2, {-2.25, .25, .5, 0.15}},
+   {SHAPE_CUBE, 2, {1.65, .1, .5, 0.6, 0.1, 0.2}},
+   {SHAPE_CUBE, 2, {2.05, 1.02, .5, 0.05, 0.01, 0.02}, SCULPTURE},
+   {SHAPE_CUBE, 2, {2.05, 1, .5, 0.01, 0.08, 0.02}, SCULPTURE},
+   {SHAPE_CUBE, 2, {1.85, .67, .5, 0.05, 0.01, 0.02}, SCULPTURE},
+   {SHAPE_CUBE, 2, {1.85, .65, .5, 0.01, 0.08, 0.02}, SCULPTURE},
+
+   // building with windows
+   {SHAPE_CUBE, 7, {0.3, .3, -.2, 0.25, 0.3, 0.2}},
+
+   // off white
+   {SHAPE_CYLINDER, 3, {0.7, 1.2, -.2, .01, 0.15}},
+   {SHAPE_CYLINDER, 3, {-0.68, 1.1, -1, .01, 0.1}},
+   {SHAPE_CYLINDER, 3, {-1.35, 1.8, -1, .02, 0.4}},
+   {SHAPE_CYLINDER, 3, {-1.15, 1.8, -1, .02, 0.4}},
+   {SHAPE_CYLINDER, 3, {-1.95, 1.2, -.25, .01, 0.15}},
+   {SHAPE_CYLINDER, 3, {-1.9, 1.2, -.2, .02, 0.25}},
+   {SHAPE_CYLINDER, 3, {-1.6, 1.2, -.2, .02, 0.25}},
+   {SHAPE_CYLINDER, 3, {1.1, 1.5, -.2, .01, 0.15}},
+   {SHAPE_CYLINDER, 3, {1.75, 1.1, -.2, .01, 0.4}},
+   {SHAPE_CYLINDER, 3, {1.85, 1.1, -.2, .01, 0.4}},
+   {SHAPE_CYLINDER, 3, {1.73, .2, .65, .03, 0.4}},
+   {SHAPE_CYLINDER, 3, {2.25, 0, .7, .03, 0.4}},
+};
+#define NSKY (int)(sizeof(skyline)/sizeof(object_t))
+
+store_t store;        //  Skyline and city objects
+gpucull_t* gpu;       //  City culled and drawn on the GPU (or NULL)
+occlusion_t* occ;     //  Occluders of the frame being prepared
+#define OCCLUDER 32   //  Smallest occluder (pixels across)
+graph_t* graph;       //  Transforms of the groups and skyline objects
+int graphTh;          //  View azimuth the cubes were last turned to
+#define TURNS 1       //  Store flag: turns with the view azimuth
 
 /*
- *  Draw vertex in polar coordinates
+ *  Size of a skyline object along each axis
  */
-static void Vertex(double th,double ph){
-   double x = Sin(th)*Cos(ph);
-   double y = Cos(th)*Cos(ph);
-   double z =         Sin(ph);
-   //  For a sphere at the origin, the position
-   //  and normal vectors are the same
-   glTexCoord2d(x, y);
-   glNormal3d(x,y,z);
-   glVertex3d(x,y,z);
+void objectSize(const object_t* o,double sz[3]) {
+   const double* p = o->p;
+   switch (o->shape) {
+      //  Cylinders rise from their base
+      case SHAPE_CYLINDER:
+         sz[0] = p[3]; sz[1] = p[4]; sz[2] = p[3];
+         break;
+      case SHAPE_SPHERE:
+         sz[0] = sz[1] = sz[2] = p[3];
+         break;
+      case SHAPE_HALFTORUS:
+         sz[0] = sz[1] = sz[2] = p[5];
+         break;
+      //  Cubes and tetrahedrons
+      default:
+         sz[0] = p[3]; sz[1] = p[4]; sz[2] = p[5];
+         break;
+   }
 }
 
 /*
- *  Draw a cube
- *     at (x,y,z)
- *     dimensions (dx,dy,dz)
- *     rotated th about the y axis
+ *  Matrix of a skyline object relative to its group (cubes turn by th)
  */
-static void cube(double x,double y,double z,double dx,double dy,double dz){
-      //  Set specular color to white
-   float white[] = {1,1,1,1};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
-   glColor3f(1, 1, 1);
-   //  Save transformation
-   glPushMatrix();
-   //  Offset, scale and rotate
-   glTranslated(x,y,z);
-   glRotated(th,0,1,0);
-   glScaled(dx,dy,dz);
-   //  Cube
-   glBegin(GL_QUADS);
-   //  Front
-   glNormal3f( 0, 0, 1);
-   glTexCoord2f(0,0);
-   glVertex3f(-1,-1, 1);
-   glTexCoord2f(1,0);
-   glVertex3f(+1,-1, 1);
-   glTexCoord2f(1,1);
-   glVertex3f(+1,+1, 1);
-   glTexCoord2f(0,1);
-   glVertex3f(-1,+1, 1);
-   //  Back
-   glNormal3f( 0, 0,-1);
-   glTexCoord2f(0,0);
-   glVertex3f(+1,-1,-1);
-   glTexCoord2f(1,0);
-   glVertex3f(-1,-1,-1);
-   glTexCoord2f(1,1);
-   glVertex3f(-1,+1,-1);
-   glTexCoord2f(0,1);
-   glVertex3f(+1,+1,-1);
-   //  Right
-   glNormal3f(+1, 0, 0);
-   glTexCoord2f(0,0);
-   glVertex3f(+1,-1,+1);
-   glTexCoord2f(1,0);
-   glVertex3f(+1,-1,-1);
-   glTexCoord2f(1,1);
-   glVertex3f(+1,+1,-1);
-   glTexCoord2f(0,1);
-   glVertex3f(+1,+1,+1);
-   //  Left
-   glNormal3f(-1, 0, 0);
-   glTexCoord2f(0,0);
-   glVertex3f(-1,-1,-1);
-   glTexCoord2f(1,0);
-   glVertex3f(-1,-1,+1);
-   glTexCoord2f(1,1);
-   glVertex3f(-1,+1,+1);
-   glTexCoord2f(0,1);
-   glVertex3f(-1,+1,-1);
-   //  Top
-   glNormal3f( 0,+1, 0);
-   glTexCoord2f(0,0);
-   glVertex3f(-1,+1,+1);
-   glTexCoord2f(1,0);
-   glVertex3f(+1,+1,+1);
-   glTexCoord2f(1,1);
-   glVertex3f(+1,+1,-1);
-   glTexCoord2f(0,1);
-   glVertex3f(-1,+1,-1);
-   //  Bottom
-   glNormal3f( 0,-1, 0);
-   glTexCoord2f(0,0);
-   glVertex3f(-1,-1,-1);
-   glTexCoord2f(1,0);
-   glVertex3f(+1,-1,-1);
-   glTexCoord2f(1,1);
-   glVertex3f(+1,-1,+1);
-   glTexCoord2f(0,1);
-   glVertex3f(-1,-1,+1);
-   //  End
-   glEnd();
-   //  Undo transofrmations
-   glPopMatrix();
+void localMatrix(const object_t* o,int th,mat4 M) {
+   const double* p = o->p;
+   const double* g = groups[o->group];
+   double sz[3];
+   objectSize(o,sz);
+   Mat4Identity(M);
+   Mat4Translate(M,p[0]-g[0],p[1]-g[1],p[2]-g[2]);
+   if (o->shape==SHAPE_CUBE) Mat4Rotate(M,th,0,1,0);
+   Mat4Scale(M,sz[0],sz[1],sz[2]);
 }
 
 /*
- *  Draw a ball
- *     at (x,y,z)
- *     radius (r)
+ *  Put the skyline in the object store with its transform graph
  */
-static void ball(double x,double y,double z,double r)
-{
-   int th,ph;
-   float yellow[] = {1.0,1.0,0.0,1.0};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   //  Save transformation
-   glPushMatrix();
-   //  Offset, scale and rotate
-   glTranslated(x,y,z);
-   glScaled(r,r,r);
-   //  White ball
-   glColor3f(1,1,1);
-   glMaterialf(GL_FRONT,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT,GL_SPECULAR,yellow);
-   glMaterialfv(GL_FRONT,GL_EMISSION,Emission);
-   //  Bands of latitude
-   for (ph=-90;ph<90;ph+=inc)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=2*inc)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+inc);
-      }
-      glEnd();
+void buildSkyline() {
+   int k,node[NGROUP];
+   mat4 M;
+   //  Groups are roots and their objects hang under them
+   graph = GraphCreate();
+   node[NOGROUP] = -1;
+   for (k=1;k<NGROUP;k++) {
+      Mat4Identity(M);
+      Mat4Translate(M,groups[k][0],groups[k][1],groups[k][2]);
+      node[k] = GraphAdd(graph,-1,M);
+   }
+   graphTh = sim.th;
+   for (k=0;k<NSKY;k++) {
+      object_t* o = skyline+k;
+      double sz[3];
+      int i;
+      //  Bounds in world coordinates (the groups stay where they are)
+      objectSize(o,sz);
+      i = StoreAdd(&store,o->shape,texture[o->tex],o->p[0],o->p[1],o->p[2],sz[0],sz[1],sz[2]);
+      localMatrix(o,graphTh,M);
+      store.node[i] = GraphAdd(graph,node[o->group],M);
+      store.flags[i] = o->shape==SHAPE_CUBE ? TURNS : 0;
+      store.user[i] = k;
    }
-   //  Undo transofrmations
-   glPopMatrix();
 }
 
-static void tetrahedron(double x,double y,double z,double dx,double dy,double dz){
-   float white[] = {1,1,1,1};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
-   glColor3f(1, 1, 1);
-   //  Save transformation
-   glPushMatrix();
-   //  Offset
-   glTranslated(x,y,z);
-   glScaled(dx,dy,dz);  // Move left and into the screen
-   glBegin(GL_TRIANGLES); // Begin drawing the pyramid with 4 triangles
-
-   // Front
-   glNormal3f(0, 0.5, 1);   
-   glTexCoord2d(0, 0);
-   glVertex3f(0.0f, 1.0f, 0.0f);
-   glTexCoord2d(1, 0);
-   glVertex3f(-1.0f, -1.0f, 1.0f);   
-   glTexCoord2d(0.5, 1); 
-   glVertex3f(1.0f, -1.0f, 1.0f);
-
-   // Right
-   glNormal3f(1, 0.5, 0);  
-   glTexCoord2d(0, 0);
-   glVertex3f(0.0f, 1.0f, 0.0f);   
-   glTexCoord2d(1, 0);  
-   glVertex3f(1.0f, -1.0f, 1.0f); 
-   glTexCoord2d(0.5, 1);  
-   glVertex3f(1.0f, -1.0f, -1.0f);
-
-   // Back
-   glNormal3f(0, 0.5, -1);   
-   glTexCoord2d(0, 0);
-   glVertex3f(0.0f, 1.0f, 0.0f);  
-   glTexCoord2d(1, 0);
-   glVertex3f(1.0f, -1.0f, -1.0f); 
-   glTexCoord2d(0.5, 1); 
-   glVertex3f(-1.0f, -1.0f, -1.0f);
-
-   // Left
-   glNormal3f(-1, 0.5, 0);    
-   glTexCoord2d(0, 0);   
-   glVertex3f( 0.0f, 1.0f, 0.0f);  
-   glTexCoord2d(1, 0);   
-   glVertex3f(-1.0f,-1.0f,-1.0f); 
-   glTexCoord2d(0.5, 1);   
-   glVertex3f(-1.0f,-1.0f, 1.0f);
-
-   glEnd();   
-   //  Undo transformations
-   glPopMatrix();
-
+/*
+ *  Add n plain buildings on a grid behind the skyline
+ */
+void buildCity(int n) {
+   static const int tex[] = {1,4,7};
+   int k,m=ceil(sqrt(n));
+   unsigned int seed=1;
+   for (k=0;k<n;k++) {
+      float dy;
+      //  Heights from 0.1 to 0.6
+      seed = seed*1103515245+12345;
+      dy = 0.1+0.5*((seed>>16)&0x7FFF)/32767.0;
+      StoreAdd(&store,SHAPE_CUBE,texture[tex[k%3]],0.3*(k%m-m/2),dy,-2-0.3*(k/m),0.1,dy,0.1);
+   }
 }
 
-static void sphere(double x,double y,double z,double r) {
-   const int d=5;
-   int th,ph;
-   float white[] = {1,1,1,1};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
-   glColor3f(1, 1, 1);
-
-   //  Save transformation
-   glPushMatrix();
-   //  Offset and scale
-   glTranslated(x,y,z);
-   glScaled(r,r,r);
-
-   //  Latitude bands
-   for (ph=-90;ph<90;ph+=d)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=d)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+d);
-      }
-      glEnd();
+/*
+ *  Eye, center and up vectors for gluLookAt
+ */
+void eye(const state_t* s,double v[9]) {
+   //  Perspective - set eye position
+   if (s->mode) {
+      v[0] = -2*s->dim*Sin(s->th)*Cos(s->ph);
+      v[1] = +2*s->dim        *Sin(s->ph);
+      v[2] = +2*s->dim*Cos(s->th)*Cos(s->ph);
+      v[3] = v[4] = v[5] = 0;
+      v[6] = 0; v[7] = Cos(s->ph); v[8] = 0;
    }
+   // First Person Perspective
+   else {
+      v[0] = s->EX;
+      v[1] = s->EY;
+      v[2] = s->EZ;
+      v[3] = s->EX - 2*s->dim*Sin(s->vth)*Cos(s->vph);
+      v[4] = s->EY - 2*s->dim        *Sin(s->vph);
+      v[5] = s->EZ - 2*s->dim*Cos(s->vth)*Cos(s->vph);
+      v[6] = 0; v[7] = 1; v[8] = 0;
+   }
+}
 
-   //  Undo transformations
-   glPopMatrix();
+/*
+ *  Tessellation step for a round part r pixels across (radius)
+ *    The chord error stays under half a pixel with pi*sqrt(r) segments
+ */
+int detail(double r) {
+   static const int step[] = {45,30,15,10};
+   int k;
+   for (k=0;k<4;k++)
+      if (360.0/step[k] >= PI*sqrt(r))
+         return step[k];
+   return 5;
 }
 
-/**
- * Draws a cylinder
- * */
-void cylinder(double doubleX, double doubleY, double doubleZ, double radius, double height){
-   const int d=5;
-   float white[] = {1,1,1,1};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
-   glColor3f(1, 1, 1);
-  //  Save transformation
-  glPushMatrix();
-  //  Offset and scale
-  glTranslated(doubleX, doubleY, doubleZ);
-  glScalef(radius, height, radius);
-
-  glBegin(GL_TRIANGLE_FAN);
-  glVertex3f(0, 0, 0);
-  for (int th=0; th<=360; th+=d) {
-    glNormal3f(0, 1, 0);
-    glTexCoord2d(Sin(th), Cos(th));
-    glVertex3f(Sin(th), 0, Cos(th));
-  }
-  glEnd();
-
-  for (int th=0; th<=360; th+=d) {
-    glBegin(GL_QUADS);
-    glTexCoord2d(Cos(th), Sin(th));
-    glNormal3f(Cos(th), 0, Sin(th));
-    glVertex3f(Sin(th), 0, Cos(th));
-    glVertex3f(Sin(th), 1, Cos(th));
-    glVertex3f(Sin(th+d), 1, Cos(th+d));
-    glVertex3f(Sin(th+d), 0, Cos(th+d));
-    glEnd();
-  }
-
-  glBegin(GL_TRIANGLE_FAN);
-  glVertex3f(0, 1, 0);
-  for (int th=0; th<=360; th+=d) {
-    glNormal3f(0, -1, 0);
-    glTexCoord2d(Sin(th), Cos(th));
-    glVertex3f(Sin(th), 1, Cos(th));
-  }
-  glEnd();
-  //  Undo transformations
-  glPopMatrix();
+//  Frame in the pipeline: the scene it shows and its draw packets
+typedef struct
+{
+   state_t  s;          //  Snapshot of the scene
+   double   asp;        //  Aspect ratio
+   int      height;     //  Viewport height (pixels)
+   mat4     view;       //  View matrix
+   vec4     plane[6];   //  View frustum
+   queue_t* queue;      //  Draw packets
+   int*     index;      //  Objects in view
+   float*   depth;      //  Their distance in front of the eye
+   job_t*   job;        //  Preparing the packets
+   int      culled;     //  Objects outside the view
+   int      occluded;   //  Objects hidden behind occluders
+} frame_t;
+
+frame_t frames[2];
+int prepared=-1;     //  Frame being prepared (-1 before the first)
+
+/*
+ *  World matrix of an object from the transform graph, or its position and size
+ */
+const float* worldMatrix(int i,mat4 M) {
+   if (store.node[i]>=0)
+      return GraphWorld(graph,store.node[i]);
+   Mat4Identity(M);
+   Mat4Translate(M,store.x[i],store.y[i],store.z[i]);
+   Mat4Scale(M,store.sx[i],store.sy[i],store.sz[i]);
+   return M;
 }
 
-/**
- * Draws a torus cut in half along the y axis; adapted code from https://www.opengl.org/archives/resources/code/samples/redbook/torus.c
- * */
-static void halfTorus(double doubleX, double doubleY, double doubleZ, int numc, int numt, double r) {
-   
-   float white[] = {1,1,1,1};
-   float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,shiny);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
-   
-   glPushMatrix();
-   glTranslated(doubleX, doubleY, doubleZ);
-   glScaled(r,r,r);
-   
-   glColor3f(1,1,1);
-   int i, j, k;
-   double s, t, x, y, z, twopi;
-
-   twopi = 2 * PI;
-   for (i = 0; i < numc; i++) {
-      glBegin(GL_QUAD_STRIP);
-      for (j = 0; j <= numt / 2; j++) {
-         for (k = 1; k >= 0; k--) {
-            s = (i + k) % numc + 0.5;
-            t = j % numt;
-
-            x = (1+.2*cos(s*twopi/numc))*cos(t*twopi/numt);
-            y = (1+.4*cos(s*twopi/numc))*sin(t*twopi/numt);
-            z = .5 * sin(s * twopi / numc);
-
-            double textureX = (i + k) / (float) numc;
-            double textureY = t / (float) numt;
-
-            glTexCoord2d(textureX, textureY);
-            glNormal3f(x, y, z);
-            glVertex3f(x, y, z);
+/*
+ *  Build the draw packets of a frame: cull the skyline to the view and
+ *  behind nearer buildings, pick the tessellation and queue what is left
+ *    Runs on the job system while the previous frame is drawn
+ */
+void prepareFrame(void* arg) {
+   frame_t* f = (frame_t*)arg;
+   const state_t* s = &f->s;
+   const float* V = f->view;
+   double v[9],scale;
+   mat4 P,PV;
+   int k,n,m;
+   Trace("prepareFrame");
+   eye(s,v);
+   Mat4Project(P,s->fov,f->asp,s->dim);
+   Mat4LookAt(f->view,v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],v[8]);
+   Mat4Multiply(PV,P,V);
+   Mat4Frustum(f->plane,PV);
+   //  Pixels per unit at unit distance (perspective) or anywhere (orthogonal)
+   scale = s->fov ? f->height/(2*tan(s->fov*PI/360)) : f->height/(2*s->dim);
+
+   //  The cubes turn with the view azimuth and everything else stays put,
+   //  so only their world matrixes are worked out again and only then
+   if (s->th!=graphTh) {
+      mat4 M;
+      graphTh = s->th;
+      for (k=0;k<store.n;k++) {
+         if (!(store.flags[k]&TURNS)) continue;
+         localMatrix(skyline+store.user[k],graphTh,M);
+         GraphLocal(graph,store.node[k],M);
+      }
+   }
+   GraphUpdate(graph);
+
+   //  Shapes go into the render queue, which sorts them by texture and depth
+   QueueBegin(f->queue,V);
+   QueueMaterial(f->queue,s->shiny,s->emission);
+   //  The city is left to the GPU when it culls it
+   m = gpu ? NSKY : store.n;
+   n = StoreCull(&store,m,f->plane,V,f->index,f->depth);
+   f->culled = m-n;
+   //  Cubes large on screen hide what is behind them
+   f->occluded = 0;
+   if (occlude) {
+      OcclusionBegin(occ,PV);
+      for (k=0;k<n;k++) {
+         int i = f->index[k];
+         mat4 M;
+         if (store.shape[i]!=SHAPE_CUBE || f->depth[k]<=0) continue;
+         if (2*store.r[i]*(s->fov ? scale/f->depth[k] : scale) < OCCLUDER) continue;
+         OcclusionBox(occ,worldMatrix(i,M));
+      }
+      OcclusionRender(occ);
+   }
+   for (k=0;k<n;k++) {
+      int i = f->index[k];
+      int shape = store.shape[i];
+      float depth = f->depth[k];
+      mat4 M,B;
+      const float* W = worldMatrix(i,M);
+      //  Cubes, tetrahedrons and spheres fill the box of their world
+      //  matrix, anything else is tested by the box around its sphere
+      if (occlude) {
+         const float* box = W;
+         if (shape==SHAPE_CYLINDER || shape==SHAPE_HALFTORUS) {
+            Mat4Identity(B);
+            Mat4Translate(B,store.cx[i],store.cy[i],store.cz[i]);
+            Mat4Scale(B,store.r[i],store.r[i],store.r[i]);
+            box = B;
+         }
+         if (!OcclusionVisible(occ,box)) {
+            f->occluded++;
+            continue;
          }
       }
-      glEnd();
+      //  Size on screen of the round part of spheres and cylinders
+      if (shape==SHAPE_SPHERE || shape==SHAPE_CYLINDER) {
+         double r = (s->fov && depth<=store.r[i]) ? 1e9 : s->fov ? store.sx[i]*scale/depth : store.sx[i]*scale;
+         QueueDetail(f->queue,detail(r));
+      }
+      //  Half tori keep their rings and segments in the skyline table
+      if (shape==SHAPE_HALFTORUS) {
+         const double* p = skyline[store.user[i]].p;
+         QueueShape(f->queue,store.texture[i],shape,W,(int)p[3],(int)p[4]);
+      }
+      else
+         QueueShape(f->queue,store.texture[i],shape,W,0,0);
    }
-   glPopMatrix();
+   //  Modelview matrixes and draw order
+   QueueEnd(f->queue);
 }
 
-void drawSkyline() {
-   //  Chicago Skyline
-   glEnable(GL_TEXTURE_2D);
-
-   // dark buildings
-   glBindTexture(GL_TEXTURE_2D,texture[1]);
-   cube(-1.75, .6, -.2, 0.22, 0.6, 0.2);
-   cube(-1.25, .9, -1, 0.15, 0.9, 0.2);
-   cube(1.1, .75, -.2, 0.08, 0.75, 0.2);
-   cube(1.45, .6, -.2, 0.15, 0.6, 0.2);
-   cube(1.8, .6, -.2, 0.1, 0.6, 0.2);
-   cube(1, .7, -.2, 0.08, 0.7, 0.2);
-
-   // light building
-   glBindTexture(GL_TEXTURE_2D,texture[4]);
-   cube(-1.65, .3, -1, 0.35, 0.3, 0.2);
-   cube(-2.25, .35, -.2, 0.2, 0.35, 0.2);
-   cube(-1, .7, -1, 0.15, 0.7, 0.2);
-   cube(-0.7, .3, -1, 0.25, 0.3, 0.2);
-   cube(-0.65, .65, -1, 0.13, 0.05, 0.1);
-   cube(-0.65, .65, -1, 0.08, 0.3, 0.1);
-   cube(-0.65, .95, -1, 0.05, 0.15, 0.1);
-   cube(0.95, .3, -.75, 0.1, 0.3, 0.1);
-   cube(0.95, .1, -.75, 0.3, 0.1, 0.1);
-   cube(1.1, .4, -.75, 0.15, 0.4, 0.1);
-   cube(0.7, .5, -.2, 0.1, 0.5, 0.2);
-   
-   // shiny metal
-   glBindTexture(GL_TEXTURE_2D,texture[0]);
-   halfTorus(-.15, 0, .2, 8, 26, .25);
-   
-   // windows
-   glBindTexture(GL_TEXTURE_2D,texture[6]);
-   tetrahedron(0.15, .8, -.2, .1, .2, .2);
-   tetrahedron(0.45, .8, -.2, .1, .2, .2);
-   tetrahedron(0.7, 1.1, -.2, .1, .12, .12);
-   tetrahedron(1.85, .5, .5, .1, .1, .12);
-   tetrahedron(2.05, .8, .5, .1, .2, .12);
-
-   // stain glass
-   glBindTexture(GL_TEXTURE_2D,texture[5]);
-   cube(2.05, .3, .5, 0.1, 0.3, 0.1);
-   cube(1.85, .3, .5, 0.1, 0.1, 0.1);
-  
-   // Louvre
-   glBindTexture(GL_TEXTURE_2D,texture[8]);
-   cube(-2.25, .15, .5, 0.15, 0.15, 0.15);
-
-   // concrete
-   glBindTexture(GL_TEXTURE_2D,texture[2]);
-   sphere(-2.25, .25, .5, 0.15);
-   cube(1.65, .1, .5, 0.6, 0.1, 0.2);
-   cube(2.05, 1.02, .5, 0.05, 0.01, 0.02);
-   cube(2.05, 1, .5, 0.01, 0.08, 0.02);
-   cube(1.85, .67, .5, 0.05, 0.01, 0.02);
-   cube(1.85, .65, .5, 0.01, 0.08, 0.02);
-
-   // building with windows
-   glBindTexture(GL_TEXTURE_2D,texture[7]);
-   cube(0.3, .3, -.2, 0.25, 0.3, 0.2);
+/*
+ *  Start preparing a frame from the newest scene
+ */
+void startFrame(int k) {
+   frame_t* f = frames+k;
+   f->s = *(state_t*)TripleRead(&scene);
+   f->asp = asp;
+   f->height = height;
+   f->job = JobCreate(prepareFrame,f);
+   JobRun(f->job);
+}
 
-   // off white
-   glBindTexture(GL_TEXTURE_2D,texture[3]);
-   cylinder(0.7, 1.2, -.2, .01, 0.15);
-   cylinder(-0.68, 1.1, -1, .01, 0.1);
-   cylinder(-1.35, 1.8, -1, .02, 0.4);
-   cylinder(-1.15, 1.8, -1, .02, 0.4);
-   cylinder(-1.95, 1.2, -.25, .01, 0.15);
-   cylinder(-1.9, 1.2, -.2, .02, 0.25);
-   cylinder(-1.6, 1.2, -.2, .02, 0.25);
-   cylinder(1.1, 1.5, -.2, .01, 0.15);
-   cylinder(1.75, 1.1, -.2, .01, 0.4);
-   cylinder(1.85, 1.1, -.2, .01, 0.4);
-   cylinder(1.73, .2, .65, .03, 0.4);
-   cylinder(2.25, 0, .7, .03, 0.4);
-   
+/*
+ *  Draw the packets of a frame
+ */
+void drawSkyline(frame_t* f) {
+   Trace("drawSkyline");
+   glEnable(GL_TEXTURE_2D);
+   QueueFlush(f->queue);
    glDisable(GL_TEXTURE_2D);
 }
 
@@ -474,48 +481,78 @@ void drawSkyline() {
  */
 void display() {
    const double len=1.5;  //  Length of axes
+   frame_t* f;            //  Frame being drawn
+   Trace("display");
+   //  Frame prepared during the last frame (the first frame waits for its own)
+   if (prepared<0) {
+      prepared = 0;
+      startFrame(prepared);
+   }
+   f = frames+prepared;
+   JobWait(f->job);
+   S = &f->s;
+   //  Exit before handing the next frame to the workers, so no job is
+   //  running while the exit handlers write the trace
+   if (S->quit) exit(0);
+   //  Prepare the next frame from the newest scene while this one is drawn
+   prepared = 1-prepared;
+   startFrame(prepared);
+   //  The next frame is already out of date, so draw it too
+   stale = frames[prepared].s.version!=S->version || frames[prepared].asp!=f->asp ||
+           frames[prepared].height!=f->height;
+   if (stale) wake();
+   //  Camera path frame times (headless mode reports the rendering time instead)
+   if (path) {
+      int t = glutGet(GLUT_ELAPSED_TIME);
+      if (!headless && lastFrame>=0) CameraPathFrame(t-lastFrame);
+      lastFrame = t;
+      //  End of the path
+      if (!S->path) {
+         CameraPathReport();
+         path = 0;
+      }
+   }
+   //  Start GPU timing for the frame
+   PerfFrame();
+#ifdef GLCOUNT
+   //  Start counting OpenGL calls for the frame
+   GLCountFrame();
+#endif
+#ifdef GLCACHE
+   GLCache(S->cache);
+#endif
    //  Erase the window and the depth buffer
    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
    //  Enable Z-buffering in OpenGL
    glEnable(GL_DEPTH_TEST);
    // Enable face culling in OpenGL
    glEnable(GL_CULL_FACE);
-   //  Undo previous transformations
-   glLoadIdentity();
-
-   //  Perspective - set eye position
-   if (mode){
-      double Ex = -2*dim*Sin(th)*Cos(ph);
-      double Ey = +2*dim        *Sin(ph);
-      double Ez = +2*dim*Cos(th)*Cos(ph);
-      gluLookAt(Ex,Ey,Ez , 0,0,0 ,0,Cos(ph),0);
-   }
-   // First Person Perspective
-   else{
-      MX = -2*dim*Sin(th)*Cos(ph);
-      MY = -2*dim        *Sin(ph);
-      MZ = -2*dim*Cos(th)*Cos(ph);
-
-      gluLookAt(EX, EY, EZ, EX + MX, EY + MY, EZ + MZ, 0,1,0);
-   }
+   //  Projection for the field of view and size of world
+   Project(S->fov, f->asp, S->dim);
+   //  Shininess and emission for the shapes
+   ShapeMaterial(S->shiny,S->emission);
+   //  Set eye position (the view matrix the frame was prepared with)
+   glLoadMatrixf(f->view);
 
    //  Light switch
-   if (light){
+   if (S->light){
+      Trace("lighting");
+      PerfBegin("light");
       //  Translate intensity to color vectors
-      float Ambient[]   = {0.01*ambient ,0.01*ambient ,0.01*ambient ,1.0};
-      float Diffuse[]   = {0.01*diffuse ,0.01*diffuse ,0.01*diffuse ,1.0};
-      float Specular[]  = {0.01*specular,0.01*specular,0.01*specular,1.0};
+      float Ambient[]   = {0.01*S->ambient ,0.01*S->ambient ,0.01*S->ambient ,1.0};
+      float Diffuse[]   = {0.01*S->diffuse ,0.01*S->diffuse ,0.01*S->diffuse ,1.0};
+      float Specular[]  = {0.01*S->specular,0.01*S->specular,0.01*S->specular,1.0};
       //  Light position
-      float Position[]  = {distance*Cos(zh),ylight,distance*Sin(zh),1.0};
+      float Position[]  = {S->distance*Cos(S->zh),S->ylight,S->distance*Sin(S->zh),1.0};
       //  Draw light position as ball (still no lighting here)
       glColor3f(1,1,1);
-      ball(Position[0],Position[1],Position[2], 0.1);
+      Ball(Position[0],Position[1],Position[2], 0.1,S->inc);
       //  OpenGL should normalize normal vectors
       glEnable(GL_NORMALIZE);
       //  Enable lighting
       glEnable(GL_LIGHTING);
       //  Location of viewer for specular calculations
-      glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER,local);
+      glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER,S->local);
       //  glColor sets ambient and diffuse color materials
       glColorMaterial(GL_FRONT_AND_BACK,GL_AMBIENT_AND_DIFFUSE);
       glEnable(GL_COLOR_MATERIAL);
@@ -526,17 +563,22 @@ void display() {
       glLightfv(GL_LIGHT0,GL_DIFFUSE ,Diffuse);
       glLightfv(GL_LIGHT0,GL_SPECULAR,Specular);
       glLightfv(GL_LIGHT0,GL_POSITION,Position);
+      PerfEnd("light");
    }
    else
       glDisable(GL_LIGHTING);
 
-   drawSkyline();
+   PerfBegin("skyline");
+   drawSkyline(f);
+   if (gpu) GpuCullDraw(gpu,f->plane,S->light,S->local,S->shiny,S->emission);
+   PerfEnd("skyline");
 
+   PerfBegin("hud");
    glDisable(GL_LIGHTING);
    //  White
    glColor3f(1,1,1);
    //  Draw axes
-   if (!axes)
+   if (!S->axes)
    {
       glBegin(GL_LINES);
       glVertex3d(0.0,0.0,0.0);
@@ -556,231 +598,403 @@ void display() {
    }
     glWindowPos2i(5,5);
    Print("Angle=%d,%d  Dim=%.1f FOV=%d Projection=%s Light=%s",
-     th,ph,dim,fov,mode?"Perpective":"First Person",light?"On":"Off");
-   if (light)
+     S->th,S->ph,S->dim,S->fov,S->mode?"Perpective":"First Person",S->light?"On":"Off");
+   if (S->light)
    {
       glWindowPos2i(5,45);
-      Print("Model=%s LocalViewer=%s Distance=%d Elevation=%.1f",smooth?"Smooth":"Flat",local?"On":"Off",distance,ylight);
+      Print("Model=%s LocalViewer=%s Distance=%d Elevation=%.1f",S->smooth?"Smooth":"Flat",S->local?"On":"Off",S->distance,S->ylight);
       glWindowPos2i(5,25);
-      Print("Ambient=%d  Diffuse=%d Specular=%d Emission=%d Shininess=%.0f",ambient,diffuse,specular,emission,shiny);
+      Print("Ambient=%d  Diffuse=%d Specular=%d Emission=%d Shininess=%.0f",S->ambient,S->diffuse,S->specular,S->emission,S->shiny);
    }
+#ifdef GLCOUNT
+   //  OpenGL calls in the last frame
+   glWindowPos2i(5,65);
+   Print("Draws=%d Vertices=%d StateChanges=%d Redundant=%d Dropped=%d",
+     GLCounts()->draws,GLCounts()->vertices,GLCounts()->states,GLCounts()->redundant,GLCounts()->skipped);
+#endif
+   PerfEnd("hud");
+   PerfFrameEnd();
+   //  Frame graph, draw counts and GPU pass times
+   if (S->overlay) PerfOverlay();
+   //  Text queued by Print
+   PrintFlush();
    //  Render the scene
+   ErrCheck("display");
    glFlush();
    //  Make the rendered scene visible
    glutSwapBuffers();
 }
 
 /*
- *  GLUT calls this routine when an arrow key is pressed
+ *  Apply an arrow or function key to the scene
  */
-void special(int key,int x,int y) {
+void applySpecial(int key,int x,int y) {
    //  Right arrow key - increase angle by 5 degrees
    if (key == GLUT_KEY_RIGHT)
-      th -= 5;
+      sim.th -= 5;
    //  Left arrow key - decrease angle by 5 degrees
    else if (key == GLUT_KEY_LEFT)
-      th += 5;
+      sim.th += 5;
    //  Up arrow key - increase elevation by 5 degrees
    else if (key == GLUT_KEY_UP)
-      ph -= 5;
+      sim.ph -= 5;
    //  Down arrow key - decrease elevation by 5 degrees
    else if (key == GLUT_KEY_DOWN)
-      ph += 5;
+      sim.ph += 5;
    //  Smooth color model
    else if (key == GLUT_KEY_F1)
-      smooth = 1-smooth;
+      sim.smooth = 1-sim.smooth;
    //  Local Viewer
    else if (key == GLUT_KEY_F2)
-      local = 1-local;
+      sim.local = 1-sim.local;
    else if (key == GLUT_KEY_F3)
-      distance = (distance==1) ? 5 : 1;
+      sim.distance = (sim.distance==1) ? 5 : 1;
    //  Toggle ball increment
    else if (key == GLUT_KEY_F8)
-      inc = (inc==10)?3:10;
+      sim.inc = (sim.inc==10)?3:10;
    //  Flip sign
    else if (key == GLUT_KEY_F9)
-      one = -one;
+      sim.one = -sim.one;
    //  Keep angles to +/-360 degrees
-   th %= 360;
-   ph %= 360;
-   //  Update projection
-   Project(fov, asp, dim);
-   //  Tell GLUT it is necessary to redisplay the scene
-   glutPostRedisplay();
-}
-
-/*
- *  GLUT calls this routine when the window is resized
- */
-void idle() {
-   //  Elapsed time in seconds
-   double t = glutGet(GLUT_ELAPSED_TIME)/1000.0;
-   zh = fmod(90*t,360.0);
-   //  Tell GLUT it is necessary to redisplay the scene
-   glutPostRedisplay();
+   sim.th %= 360;
+   sim.ph %= 360;
 }
 
 /*
- *  GLUT calls this routine when a key is pressed
+ *  Apply a key press to the scene
  */
-void key(unsigned char ch,int x,int y) {
+void applyKey(unsigned char ch,int x,int y) {
+   //  Direction of view
+   double MX = -2*sim.dim*Sin(sim.vth)*Cos(sim.vph);
+   double MZ = -2*sim.dim*Cos(sim.vth)*Cos(sim.vph);
    //  Exit on ESC
    if (ch == 27)
-      exit(0);
+      sim.quit = 1;
    //  Reset view angle
    else if (ch == '0') {
-      th = ph = 0;
-      dim = 2.6;
-      MX = 0;
-      MY = 0;
-      MZ = 0;
-      EX = 0;
-      EY = 0;
-      EZ = 2*dim;
+      sim.th = sim.ph = 0;
+      sim.dim = 2.6;
+      sim.EX = 0;
+      sim.EY = 0;
+      sim.EZ = 2*sim.dim;
    }
    //  Toggle axes
    else if (ch == 'x' || ch == 'X')
-      axes = 1-axes;
+      sim.axes = 1-sim.axes;
    //  Switch projection mode
    else if (ch == 'p' || ch == 'P')
-      mode = 1-mode;
+      sim.mode = 1-sim.mode;
    //  Change field of view angle
    else if (ch == '-' && ch>1)
-      fov--;
+      sim.fov--;
    else if (ch == '+' && ch<179)
-      fov++;
+      sim.fov++;
    //  Right Bracket - increase dim
    else if (ch == ']')
-      dim += 0.1;
+      sim.dim += 0.1;
    //  Left Bracket - decrease dim
    else if (ch == '[')
-      dim -= 0.1;
+      sim.dim -= 0.1;
    //  Toggle lighting
    else if (ch == 'l' || ch == 'L')
-      light = 1-light;
+      sim.light = 1-sim.light;
    //  Toggle light movement
    else if (ch == 'm' || ch == 'M')
-      move = 1-move;
+      sim.move = 1-sim.move;
    //  Move light
    else if (ch == '<')
-      zh += 1;
+      sim.zh += 1;
    else if (ch == '>')
-      zh -= 1;
+      sim.zh -= 1;
    //  Change field of view angle
    else if (ch == '-' && ch>1)
-      fov--;
+      sim.fov--;
    else if (ch == '+' && ch<179)
-      fov++;
+      sim.fov++;
    //  Light elevation
    else if (ch==',')
-      ylight -= 0.1;
+      sim.ylight -= 0.1;
    else if (ch=='.')
-      ylight += 0.1;
+      sim.ylight += 0.1;
    //  Ambient level
-   else if (ch=='a' && ambient>0)
-      ambient -= 5;
-   else if (ch=='A' && ambient<100)
-      ambient += 5;
+   else if (ch=='a' && sim.ambient>0)
+      sim.ambient -= 5;
+   else if (ch=='A' && sim.ambient<100)
+      sim.ambient += 5;
    //  Diffuse level
-   else if (ch=='d' && diffuse>0)
-      diffuse -= 5;
-   else if (ch=='D' && diffuse<100)
-      diffuse += 5;
+   else if (ch=='d' && sim.diffuse>0)
+      sim.diffuse -= 5;
+   else if (ch=='D' && sim.diffuse<100)
+      sim.diffuse += 5;
    //  Specular level
-   else if (ch=='s' && specular>0)
-      specular -= 5;
-   else if (ch=='S' && specular<100)
-      specular += 5;
+   else if (ch=='s' && sim.specular>0)
+      sim.specular -= 5;
+   else if (ch=='S' && sim.specular<100)
+      sim.specular += 5;
    //  Emission level
-   else if (ch=='e' && emission>0)
-      emission -= 5;
-   else if (ch=='E' && emission<100)
-      emission += 5;
+   else if (ch=='e' && sim.emission>0)
+      sim.emission -= 5;
+   else if (ch=='E' && sim.emission<100)
+      sim.emission += 5;
    //  Shininess level
-   else if (ch=='n' && shininess>-1)
-      shininess -= 1;
-   else if (ch=='N' && shininess<7)
-      shininess += 1;
+   else if (ch=='n' && sim.shininess>-1)
+      sim.shininess -= 1;
+   else if (ch=='N' && sim.shininess<7)
+      sim.shininess += 1;
    // Go forwards into the scene
    else if (ch == 'y' || ch == 'Y') {
-		EX += MX * .1;
-      EZ += MZ * .1;
+		sim.EX += MX * .1;
+      sim.EZ += MZ * .1;
    }
    // Go backwards from the scene
    else if (ch == 'h' || ch == 'h') {
-		EX -= MX * .1;
-      EZ -= MZ * .1;
+		sim.EX -= MX * .1;
+      sim.EZ -= MZ * .1;
    }
    // Look at the x axis
    else if (ch == 'j' || ch == 'J') {
-		th = -90;
-      ph = 0;
+		sim.th = -90;
+      sim.ph = 0;
    }
    // Look at the y axis
    else if (ch == 'g' || ch == 'G') {
-		th = 90;
-      ph = 0;
+		sim.th = 90;
+      sim.ph = 0;
    }
    // Look forward again
    else if (ch == 'e' || ch == 'E') {
-		th = 0;
-      ph = 0;
+		sim.th = 0;
+      sim.ph = 0;
    }
+   //  Toggle performance overlay
+   else if (ch == 'o' || ch == 'O')
+      sim.overlay = 1-sim.overlay;
+#ifdef GLCACHE
+   //  Toggle redundant state filtering
+   else if (ch == 'c' || ch == 'C')
+      sim.cache = 1-sim.cache;
+#endif
    //  Translate shininess power to value (-1 => 0)
-   shiny = shininess<0 ? 0 : pow(2.0,shininess);
+   sim.shiny = sim.shininess<0 ? 0 : pow(2.0,sim.shininess);
+}
 
-   //  Reproject
-   Project(fov, asp, dim);
-   //  Animate if requested
-   glutIdleFunc(move?idle:NULL);
-   //  Tell GLUT it is necessary to redisplay the scene
-   glutPostRedisplay();
+/*
+ *  Advance the scene to ms and publish a snapshot for the renderer
+ *    Runs on the simulation thread, or before each frame when headless
+ *    Returns whether the scene will change without input
+ */
+int simulate(int ms) {
+   int special,code;
+   double t = ms/1000.0;
+   state_t* next;
+   Trace("simulate");
+   //  Key presses, live and recorded
+   while (InputPop(&special,&code)) {
+      if (special)
+         applySpecial(code,0,0);
+      else
+         applyKey(code,0,0);
+   }
+   ReplayPoll(ms,applyKey,applySpecial);
+   if (sim.move)
+      sim.zh = fmod(90*t,360.0);
+   //  Camera path sets the eye position and view angles
+   sim.vth = sim.th;
+   sim.vph = sim.ph;
+   if (sim.path) {
+      if (pathStart<0) pathStart = t;
+      if (!CameraPathPose(t-pathStart,&sim.EX,&sim.EY,&sim.EZ,&sim.vth,&sim.vph)) {
+         //  End of the path - hand the camera back
+         sim.path = 0;
+         sim.th = (int)floor(sim.vth+0.5);
+         sim.ph = (int)floor(sim.vph+0.5);
+      }
+   }
+   //  Count the steps that change something, so an unchanged scene is not redrawn
+   if (memcmp(&sim,&last,sizeof(sim))) {
+      sim.version++;
+      memcpy(&last,&sim,sizeof(sim));
+   }
+   //  Publish
+   next = TripleWrite(&scene);
+   *next = sim;
+   TriplePublish(&scene);
+   //  Moving light, camera path or recorded keys still to come
+   return sim.move || sim.path || ReplayPending();
 }
 
+/*
+ *  GLUT calls this routine fps times a second in a window
+ *    Redraw only when the scene or the window changed, and stop once
+ *    the simulation is asleep and its last snapshot is drawn
+ */
+void tick(int k) {
+   int idle = SimIdle();
+   if (prepared<0 || stale || ((state_t*)TripleRead(&scene))->version!=frames[prepared].s.version)
+      glutPostRedisplay();
+   else if (idle) {
+      ticking = 0;
+      return;
+   }
+   glutTimerFunc(1000/fps,tick,0);
+}
+
+/*
+ *  Poll for snapshots again after input
+ */
+void wake() {
+   if (!ticking && !headless) {
+      ticking = 1;
+      glutTimerFunc(0,tick,0);
+   }
+}
+
+/*
+ *  GLUT calls this routine when an arrow key is pressed
+ */
+void special(int key,int x,int y) {
+   RecordEvent(1,key);
+   //  The simulation applies it
+   InputPush(1,key);
+   wake();
+}
+
+/*
+ *  GLUT calls this routine when a key is pressed
+ */
+void key(unsigned char ch,int x,int y) {
+   RecordEvent(0,ch);
+   //  Save the newest view as a camera path keyframe (file I/O stays on this thread)
+   if (ch == 'k' || ch == 'K') {
+      const state_t* v = TripleRead(&scene);
+      CameraPathAppend("camera.path",v->EX,v->EY,v->EZ,v->th,v->ph);
+   }
+   //  The simulation applies everything else
+   else {
+      InputPush(0,ch);
+      wake();
+   }
+}
 
+/*
+ *  GLUT calls this routine when there is nothing else to do (headless only)
+ */
+void idle() {
+   Trace("idle");
+   //  Headless runs step the simulation before each frame at the fixed frame time
+   simulate(glutGet(GLUT_ELAPSED_TIME));
+   //  Draw the newest snapshot
+   glutPostRedisplay();
+}
 
 /*
  *  GLUT calls this routine when the window is resized
  */
-void reshape(int width,int height) {
+void reshape(int width,int h) {
    //  Ratio of the width to the height of the window
+   height = h;
    asp = (height>0) ? (double)width/height : 1;
    //  Set the viewport to the entire window
    glViewport(0,0, width,height);
    //  Set projection
-   Project(fov, asp, dim);
+   Project(S->fov, asp, S->dim);
 }
 
 /*
  *  Start up GLUT and tell it what to do
  */
 int main(int argc,char* argv[]) {
-   //  Initialize GLUT and process user parameters
-   glutInit(&argc,argv);
-   //  Request double buffered, true color window with Z buffering at 600x600
-   glutInitWindowSize(600,600);
-   glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
-   //  Create the window
-   glutCreateWindow("Gabriella Johnson: Textures");
-   //  Tell GLUT to call "display" when the scene should be drawn
-   glutDisplayFunc(display);
-   //  Tell GLUT to call "reshape" when the window is resized
-   glutReshapeFunc(reshape);
-   //  Tell GLUT to call "special" when an arrow key is pressed
-   glutSpecialFunc(special);
-   //  Tell GLUT to call "key" when a key is pressed
-   glutKeyboardFunc(key);
-   glutIdleFunc(idle);
-   //  Load textures
-   texture[0] = LoadTexBMP("shinyMetal.bmp");
-   texture[1] = LoadTexBMP("building1.bmp");
-   texture[2] = LoadTexBMP("concrete.bmp");
-   texture[3] = LoadTexBMP("cylinder.bmp");
-   texture[4] = LoadTexBMP("building.bmp");
-   texture[5] = LoadTexBMP("stainGlass.bmp");
-   texture[6] = LoadTexBMP("glass.bmp");
-   texture[7] = LoadTexBMP("buildingWindow.bmp");
-   texture[8] = LoadTexBMP("louvre.bmp");
+   int k;
+   //  Render offscreen when benchmarking
+   headless = Headless(&argc,argv);
+   if (!headless) {
+      //  Initialize GLUT and process user parameters
+      glutInit(&argc,argv);
+      //  Request double buffered, true color window with Z buffering at 600x600
+      glutInitWindowSize(600,600);
+      glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
+      //  Create the window
+      glutCreateWindow("Gabriella Johnson: Textures");
+      //  Tell GLUT to call "display" when the scene should be drawn
+      glutDisplayFunc(display);
+      //  Tell GLUT to call "reshape" when the window is resized
+      glutReshapeFunc(reshape);
+      //  Tell GLUT to call "special" when an arrow key is pressed
+      glutSpecialFunc(special);
+      //  Tell GLUT to call "key" when a key is pressed
+      glutKeyboardFunc(key);
+   }
+   //  Report OpenGL errors without waiting on glGetError
+   GLDebug();
+   //  Camera path and input recording
+   for (k=1;k<argc;k+=2) {
+      if (k+1==argc)
+         Fatal("Missing file name after %s\n",argv[k]);
+      else if (!strcmp(argv[k],"-path")) {
+         CameraPath(argv[k+1]);
+         path = sim.path = 1;
+      }
+      else if (!strcmp(argv[k],"-record"))
+         RecordEvents(argv[k+1]);
+      else if (!strcmp(argv[k],"-play"))
+         ReplayEvents(argv[k+1]);
+      else if (!strcmp(argv[k],"-trace"))
+         TraceOpen(argv[k+1]);
+      else if (!strcmp(argv[k],"-jobs"))
+         JobInit(atoi(argv[k+1]));
+      else if (!strcmp(argv[k],"-city"))
+         city = atoi(argv[k+1]);
+      else if (!strcmp(argv[k],"-cull")) {
+         if (strcmp(argv[k+1],"cpu") && strcmp(argv[k+1],"gpu")) Fatal("Culling must be cpu or gpu\n");
+         gpuCull = !strcmp(argv[k+1],"gpu");
+      }
+      else if (!strcmp(argv[k],"-occlude")) {
+         if (strcmp(argv[k+1],"on") && strcmp(argv[k+1],"off")) Fatal("Occlusion culling must be on or off\n");
+         occlude = !strcmp(argv[k+1],"on");
+      }
+      else if (!strcmp(argv[k],"-fps")) {
+         fps = atoi(argv[k+1]);
+         if (fps<1 || fps>1000) Fatal("Frame rate must be 1-1000\n");
+      }
+      else
+         Fatal("Unknown option %s\n",argv[k]);
+   }
+   //  Load textures (decoded in parallel)
+   LoadTexBMPs(9,textures,texture);
+   //  Scene objects
+   buildSkyline();
+   buildCity(city);
+   if (gpuCull) {
+      gpu = GpuCullCreate(&store,NSKY);
+      if (!gpu) fprintf(stderr,"GPU culling needs OpenGL 4.4, culling on the CPU\n");
+   }
+   //  Occlusion buffer shared by the frames, which are prepared one at a time
+   occ = OcclusionCreate(256,128);
+   //  Render queues and culling output for the frames in flight
+   for (k=0;k<2;k++) {
+      frames[k].queue = QueueCreate();
+      frames[k].index = (int*)malloc(store.n*sizeof(int));
+      frames[k].depth = (float*)malloc(store.n*sizeof(float));
+      if (!frames[k].index || !frames[k].depth) Fatal("Cannot allocate culling for %d objects\n",store.n);
+   }
+   //  First snapshot, then step the scene on its own thread at 120 Hz
+   TripleInit(&scene,snapshot,snapshot+1,snapshot+2);
+   simulate(0);
+   S = TripleRead(&scene);
+   if (!headless) {
+      SimStart(simulate,120);
+      //  Redraw on demand instead of from an idle callback, so an unchanged
+      //  scene costs no CPU
+      wake();
+   }
+   //  Benchmark offscreen
+   if (headless) {
+      HeadlessFrameFunc(CameraPathFrame);
+      k = HeadlessRun(display,reshape,idle);
+      //  Path still running when the frames ran out
+      if (path) CameraPathReport();
+      return k;
+   }
    //  Pass control to GLUT so it can interact with the user
    glutMainLoop();
    return 0;
@@ -0,0 +1,469 @@
+/*
+ *  Work-stealing job system
+ *
+ *  Worker threads and every thread that submits jobs own a Chase-Lev
+ *  deque.  The owner pushes and pops jobs at the bottom without locks,
+ *  and idle threads steal from the top of a random victim, so a thread
+ *  works through its own jobs newest first while thieves take the
+ *  oldest (usually largest) ones.  Workers that find nothing to steal
+ *  sleep until a job is pushed.
+ *
+ *  A job runs once JobRun has been called and every job given to
+ *  JobAfter has finished.  JobWait runs other jobs while it waits, so
+ *  jobs may wait on jobs without tying up a thread, and sleeps when
+ *  there is nothing to run until a job is pushed or finishes.  The handle from
+ *  JobCreate stays valid until it is passed to JobWait or JobRelease,
+ *  and every handle must be passed to one of them.
+ *
+ *  JobInit(n) starts n workers; without it the first job starts one
+ *  worker per core less the calling thread (once, however many threads
+ *  get there together).  With no workers the jobs
+ *  run on the thread that waits for them.
+ */
+#include "CSCIx229.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define DEQUE     4096  //  Jobs per deque (power of two)
+#define MAXTHREAD 64    //  Threads with deques
+#define MAXAFTER  8     //  Jobs waiting on one job (more wait in a chain)
+#define SPIN      64    //  Failed steal rounds before a thread sleeps
+
+struct job_t
+{
+   void  (*func)(void* arg);
+   void*   arg;
+   int     deps;              //  Unfinished dependencies + 1 until JobRun
+   int     refs;              //  Handle and scheduler references
+   int     done;              //  Finished
+   int     lock;              //  Guards done and after
+   int     nafter;
+   job_t*  after[MAXAFTER];   //  Jobs waiting for this one
+   job_t*  chain;             //  Holds the dependents that did not fit
+};
+
+//  Chase-Lev deque (indexes on separate cache lines)
+typedef struct
+{
+   long   top    __attribute__((aligned(64)));
+   long   bottom __attribute__((aligned(64)));
+   job_t* buf[DEQUE];
+} deque_t;
+
+static deque_t* deques[MAXTHREAD];
+static int      nthread=0;          //  Deques in use
+static int      workers=-1;         //  Worker threads (-1 before JobInit)
+static int      queued=0;           //  Jobs in deques
+static int      sleepers=0;         //  Workers waiting for jobs
+static int      waiters=0;          //  JobWait callers asleep
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t start = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  finished = PTHREAD_COND_INITIALIZER;
+static __thread int    self=-1;     //  This thread's deque
+static __thread unsigned seed=0;    //  Victim selection
+
+/*
+ *  Deque of the calling thread, created on first use
+ */
+static deque_t* Mine(void)
+{
+   if (self<0)
+   {
+      deque_t* d = (deque_t*)calloc(1,sizeof(deque_t));
+      if (!d) Fatal("Cannot allocate job deque\n");
+      self = __atomic_fetch_add(&nthread,1,__ATOMIC_RELAXED);
+      if (self>=MAXTHREAD) Fatal("More than %d threads submitting jobs\n",MAXTHREAD);
+      seed = 2654435761u*(self+1);
+      __atomic_store_n(&deques[self],d,__ATOMIC_RELEASE);
+   }
+   return deques[self];
+}
+
+/*
+ *  Owner end of the deque
+ *    Push returns 0 if the deque is full
+ */
+static int Push(deque_t* d,job_t* job)
+{
+   long b = __atomic_load_n(&d->bottom,__ATOMIC_RELAXED);
+   long t = __atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+   if (b-t>=DEQUE) return 0;
+   __atomic_store_n(&d->buf[b&(DEQUE-1)],job,__ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+   return 1;
+}
+
+static job_t* Pop(deque_t* d)
+{
+   job_t* job=NULL;
+   long   b = __atomic_load_n(&d->bottom,__ATOMIC_RELAXED)-1;
+   long   t;
+   __atomic_store_n(&d->bottom,b,__ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   t = __atomic_load_n(&d->top,__ATOMIC_RELAXED);
+   if (t<=b)
+   {
+      job = __atomic_load_n(&d->buf[b&(DEQUE-1)],__ATOMIC_RELAXED);
+      //  Last job - race the thieves for it
+      if (t==b)
+      {
+         if (!__atomic_compare_exchange_n(&d->top,&t,t+1,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+            job = NULL;
+         __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+      }
+   }
+   else
+      __atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+   return job;
+}
+
+/*
+ *  Thief end of the deque
+ */
+static job_t* Steal(deque_t* d)
+{
+   long t = __atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+   long b;
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   b = __atomic_load_n(&d->bottom,__ATOMIC_ACQUIRE);
+   if (t<b)
+   {
+      job_t* job = __atomic_load_n(&d->buf[t&(DEQUE-1)],__ATOMIC_RELAXED);
+      if (__atomic_compare_exchange_n(&d->top,&t,t+1,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+         return job;
+   }
+   return NULL;
+}
+
+/*
+ *  Next job for the calling thread: its own newest, else a stolen one
+ */
+static job_t* Find(void)
+{
+   int k,n = __atomic_load_n(&nthread,__ATOMIC_ACQUIRE);
+   job_t* job = Pop(Mine());
+   for (k=0;!job && k<n;k++)
+   {
+      deque_t* d;
+      seed = seed*1664525u + 1013904223u;
+      d = __atomic_load_n(&deques[(seed>>16)%n],__ATOMIC_ACQUIRE);
+      if (d && d!=deques[self]) job = Steal(d);
+   }
+   if (job) __atomic_sub_fetch(&queued,1,__ATOMIC_SEQ_CST);
+   return job;
+}
+
+static void Lock(job_t* job)
+{
+   while (__atomic_exchange_n(&job->lock,1,__ATOMIC_ACQUIRE))
+      while (__atomic_load_n(&job->lock,__ATOMIC_RELAXED))
+         sched_yield();
+}
+
+static void Unlock(job_t* job)
+{
+   __atomic_store_n(&job->lock,0,__ATOMIC_RELEASE);
+}
+
+/*
+ *  Wake the JobWait callers that are asleep
+ */
+static void WakeWaiters(void)
+{
+   if (__atomic_load_n(&waiters,__ATOMIC_SEQ_CST))
+   {
+      pthread_mutex_lock(&mutex);
+      pthread_cond_broadcast(&finished);
+      pthread_mutex_unlock(&mutex);
+   }
+}
+
+static void Release(job_t* job)
+{
+   if (!__atomic_sub_fetch(&job->refs,1,__ATOMIC_ACQ_REL)) free(job);
+}
+
+static void Execute(job_t* job);
+
+/*
+ *  Queue a job whose dependencies are done
+ */
+static void Ready(job_t* job)
+{
+   //  A full deque runs the job here instead
+   if (!Push(Mine(),job))
+   {
+      Execute(job);
+      return;
+   }
+   __atomic_add_fetch(&queued,1,__ATOMIC_SEQ_CST);
+   if (__atomic_load_n(&sleepers,__ATOMIC_SEQ_CST))
+   {
+      pthread_mutex_lock(&mutex);
+      pthread_cond_signal(&wake);
+      pthread_mutex_unlock(&mutex);
+   }
+   //  Waiting threads help with it
+   WakeWaiters();
+}
+
+/*
+ *  One dependency of a job is done
+ */
+static void Satisfy(job_t* job)
+{
+   if (!__atomic_sub_fetch(&job->deps,1,__ATOMIC_ACQ_REL)) Ready(job);
+}
+
+/*
+ *  Run a job and release the jobs waiting for it
+ */
+static void Execute(job_t* job)
+{
+   int k;
+   {
+      Trace("job");
+      job->func(job->arg);
+   }
+   Lock(job);
+   __atomic_store_n(&job->done,1,__ATOMIC_SEQ_CST);
+   Unlock(job);
+   for (k=0;k<job->nafter;k++)
+      Satisfy(job->after[k]);
+   if (job->chain) Satisfy(job->chain);
+   WakeWaiters();
+   Release(job);
+}
+
+/*
+ *  Worker thread
+ */
+static void* Worker(void* arg)
+{
+   int idle=0;
+   Mine();
+   for (;;)
+   {
+      job_t* job = Find();
+      if (job)
+      {
+         Execute(job);
+         idle = 0;
+      }
+      else if (++idle<SPIN)
+         sched_yield();
+      //  Sleep until a job is queued
+      else
+      {
+         pthread_mutex_lock(&mutex);
+         __atomic_add_fetch(&sleepers,1,__ATOMIC_SEQ_CST);
+         if (!__atomic_load_n(&queued,__ATOMIC_SEQ_CST))
+            pthread_cond_wait(&wake,&mutex);
+         __atomic_sub_fetch(&sleepers,1,__ATOMIC_SEQ_CST);
+         pthread_mutex_unlock(&mutex);
+         idle = 0;
+      }
+   }
+   return NULL;
+}
+
+/*
+ *  Start n worker threads (call with start locked)
+ */
+static void Start(int n)
+{
+   int k;
+   if (n<0) n = sysconf(_SC_NPROCESSORS_ONLN)-1;
+   if (n>MAXTHREAD-2) n = MAXTHREAD-2;
+   if (n<0) n = 0;
+   Mine();
+   for (k=0;k<n;k++)
+   {
+      pthread_t thread;
+      if (pthread_create(&thread,NULL,Worker,NULL)) Fatal("Cannot start job worker\n");
+      pthread_detach(thread);
+   }
+   __atomic_store_n(&workers,n,__ATOMIC_RELEASE);
+}
+
+/*
+ *  Start n worker threads (negative for one per core less this thread)
+ */
+void JobInit(int n)
+{
+   pthread_mutex_lock(&start);
+   if (workers>=0) Fatal("Job system already started\n");
+   Start(n);
+   pthread_mutex_unlock(&start);
+}
+
+/*
+ *  Start the default workers unless already started
+ */
+static void Started(void)
+{
+   if (__atomic_load_n(&workers,__ATOMIC_ACQUIRE)>=0) return;
+   pthread_mutex_lock(&start);
+   if (workers<0) Start(-1);
+   pthread_mutex_unlock(&start);
+}
+
+/*
+ *  Number of worker threads
+ */
+int JobWorkers(void)
+{
+   Started();
+   return workers;
+}
+
+/*
+ *  New job calling func(arg), not yet submitted
+ */
+job_t* JobCreate(void (*func)(void* arg),void* arg)
+{
+   job_t* job;
+   Started();
+   job = (job_t*)calloc(1,sizeof(job_t));
+   if (!job) Fatal("Cannot allocate job\n");
+   job->func = func;
+   job->arg  = arg;
+   job->deps = 1;
+   job->refs = 2;
+   return job;
+}
+
+/*
+ *  Do nothing (links long dependency lists)
+ */
+static void Nothing(void* arg)
+{
+}
+
+/*
+ *  Make job wait until before has finished (call before JobRun(job))
+ */
+void JobAfter(job_t* job,job_t* before)
+{
+   Lock(before);
+   if (!before->done)
+   {
+      if (before->nafter<MAXAFTER)
+      {
+         __atomic_add_fetch(&job->deps,1,__ATOMIC_RELAXED);
+         before->after[before->nafter++] = job;
+      }
+      //  Further dependents wait on an empty job that runs after this one
+      else
+      {
+         if (!before->chain)
+         {
+            before->chain = JobCreate(Nothing,NULL);
+            Release(before->chain);
+         }
+         JobAfter(job,before->chain);
+      }
+   }
+   Unlock(before);
+}
+
+/*
+ *  Submit a job (it runs once its dependencies are done)
+ */
+void JobRun(job_t* job)
+{
+   Satisfy(job);
+}
+
+/*
+ *  Run jobs until job has finished, then release the handle
+ */
+void JobWait(job_t* job)
+{
+   int idle=0;
+   while (!__atomic_load_n(&job->done,__ATOMIC_ACQUIRE))
+   {
+      job_t* other = Find();
+      if (other)
+      {
+         Execute(other);
+         idle = 0;
+      }
+      else if (++idle<SPIN)
+         sched_yield();
+      //  Sleep until a job is queued or one finishes
+      else
+      {
+         pthread_mutex_lock(&mutex);
+         __atomic_add_fetch(&waiters,1,__ATOMIC_SEQ_CST);
+         if (!__atomic_load_n(&queued,__ATOMIC_SEQ_CST) && !__atomic_load_n(&job->done,__ATOMIC_SEQ_CST))
+            pthread_cond_wait(&finished,&mutex);
+         __atomic_sub_fetch(&waiters,1,__ATOMIC_SEQ_CST);
+         pthread_mutex_unlock(&mutex);
+         idle = 0;
+      }
+   }
+   Release(job);
+}
+
+/*
+ *  Release a handle without waiting
+ */
+void JobRelease(job_t* job)
+{
+   Release(job);
+}
+
+//  Range of a parallel for
+typedef struct
+{
+   void (*func)(int i0,int i1,void* arg);
+   void* arg;
+   int   i0,i1;
+} range_t;
+
+static void Range(void* arg)
+{
+   range_t* r = (range_t*)arg;
+   r->func(r->i0,r->i1,r->arg);
+}
+
+/*
+ *  Call func(i0,i1,arg) on slices of 0..n-1 of about grain items in
+ *  parallel and wait for all of them
+ */
+void JobFor(int n,int grain,void (*func)(int i0,int i1,void* arg),void* arg)
+{
+   int      k,m;
+   range_t* r;
+   job_t**  job;
+   if (n<=0) return;
+   if (grain<1) grain = 1;
+   m = (n+grain-1)/grain;
+   //  No helpers or one slice - just call it
+   if (m==1 || !JobWorkers())
+   {
+      func(0,n,arg);
+      return;
+   }
+   r = (range_t*)malloc(m*sizeof(range_t));
+   job = (job_t**)malloc(m*sizeof(job_t*));
+   if (!r || !job) Fatal("Cannot allocate %d job ranges\n",m);
+   for (k=0;k<m;k++)
+   {
+      r[k].func = func;
+      r[k].arg  = arg;
+      r[k].i0   = k*grain;
+      r[k].i1   = k+1<m ? (k+1)*grain : n;
+      job[k] = JobCreate(Range,r+k);
+      JobRun(job[k]);
+   }
+   //  The newest slices are on top of this thread's deque, so start there
+   for (k=m-1;k>=0;k--)
+      JobWait(job[k]);
+   free(job);
+   free(r);
+}
@@ -18,12 +18,23 @@ static void Reverse(void* x,const int n)
    }
 }
 
+//  Decoded image
+typedef struct
+{
+   const char*    file;
+   int            max;        // Maximum texture dimensions
+   unsigned int   dx,dy;      // Image dimensions
+   unsigned char* image;      // Image data (RGB)
+} bmp_t;
+
 /*
- *  Load texture from BMP file
+ *  Read and decode a BMP file
+ *    Makes no OpenGL calls, so it can run on any thread
  */
-unsigned int LoadTexBMP(const char* file)
+static void ReadBMP(bmp_t* bmp)
 {
-   unsigned int   texture;    // Texture name
+   const char*    file=bmp->file;
+   int            max=bmp->max;
    FILE*          f;          // File pointer
    unsigned short magic;      // Image magic
    unsigned int   dx,dy,size; // Image dimensions
@@ -31,7 +42,7 @@ unsigned int LoadTexBMP(const char* file)
    unsigned char* image;      // Image data
    unsigned int   off;        // Image offset
    unsigned int   k;          // Counter
-   int            max;        // Maximum texture dimensions
+   Trace("ReadBMP");
 
    //  Open file
    f = fopen(file,"rb");
@@ -55,7 +66,6 @@ unsigned int LoadTexBMP(const char* file)
       Reverse(&k,4);
    }
    //  Check image parameters
-   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
    if (dx<1 || dx>max) Fatal("%s image width %d out of range 1-%d\n",file,dx,max);
    if (dy<1 || dy>max) Fatal("%s image height %d out of range 1-%d\n",file,dy,max);
    if (nbp!=1)  Fatal("%s bit planes is not 1: %d\n",file,nbp);
@@ -83,21 +93,74 @@ unsigned int LoadTexBMP(const char* file)
       image[k]   = image[k+2];
       image[k+2] = temp;
    }
+   bmp->dx = dx;
+   bmp->dy = dy;
+   bmp->image = image;
+}
 
-   //  Sanity check
+/*
+ *  Create a texture from a decoded image and free the image
+ */
+static unsigned int Upload(bmp_t* bmp)
+{
+   unsigned int texture;    // Texture name
+   //  Sanity check (ReadBMP has checked the size against bmp->max)
    ErrCheck("LoadTexBMP");
    //  Generate 2D texture
    glGenTextures(1,&texture);
    glBindTexture(GL_TEXTURE_2D,texture);
    //  Copy image
-   glTexImage2D(GL_TEXTURE_2D,0,3,dx,dy,0,GL_RGB,GL_UNSIGNED_BYTE,image);
-   if (glGetError()) Fatal("Error in glTexImage2D %s %dx%d\n",file,dx,dy);
+   glTexImage2D(GL_TEXTURE_2D,0,3,bmp->dx,bmp->dy,0,GL_RGB,GL_UNSIGNED_BYTE,bmp->image);
+   ErrCheck("glTexImage2D");
    //  Scale linearly when image size doesn't match
    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 
    //  Free image memory
-   free(image);
+   free(bmp->image);
    //  Return texture name
    return texture;
 }
+
+/*
+ *  Load texture from BMP file
+ */
+unsigned int LoadTexBMP(const char* file)
+{
+   bmp_t bmp;
+   Trace("LoadTexBMP");
+   bmp.file = file;
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&bmp.max);
+   ReadBMP(&bmp);
+   return Upload(&bmp);
+}
+
+static void Decode(int i0,int i1,void* arg)
+{
+   int k;
+   for (k=i0;k<i1;k++)
+      ReadBMP((bmp_t*)arg+k);
+}
+
+/*
+ *  Load textures from n BMP files
+ *    The files are decoded in parallel on the job system and uploaded
+ *    by the calling thread, which owns the OpenGL context
+ */
+void LoadTexBMPs(int n,const char* file[],unsigned int texture[])
+{
+   int    k,max;
+   bmp_t* bmp = (bmp_t*)malloc(n*sizeof(bmp_t));
+   Trace("LoadTexBMPs");
+   if (!bmp) Fatal("Cannot allocate %d images\n",n);
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
+   for (k=0;k<n;k++)
+   {
+      bmp[k].file = file[k];
+      bmp[k].max = max;
+   }
+   JobFor(n,1,Decode,bmp);
+   for (k=0;k<n;k++)
+      texture[k] = Upload(bmp+k);
+   free(bmp);
+}
@@ -0,0 +1,377 @@
+/*
+ *  Single precision matrix, vector and quaternion math
+ *
+ *  Matrixes are column major like OpenGL, so a mat4 can be handed to
+ *  glLoadMatrixf as it is.  The functions that build on an existing
+ *  matrix (Mat4Translate, Mat4Rotate, Mat4Scale) multiply on the right
+ *  like glTranslate, glRotate and glScale, so a chain of them gives the
+ *  same matrix the matrix stack would.
+ *
+ *  With SSE each column is one register and a product is four
+ *  broadcasts and multiply-adds per column.  Other targets use the plain
+ *  C versions.
+ */
+#include "CSCIx229.h"
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SIMD
+#endif
+
+#define RAD (3.14159265358979323846/180)  //  Radians per degree
+
+/*
+ *  M = I
+ */
+void Mat4Identity(mat4 M)
+{
+   static const mat4 I = {1,0,0,0 , 0,1,0,0 , 0,0,1,0 , 0,0,0,1};
+   memcpy(M,I,sizeof(mat4));
+}
+
+#ifdef SIMD
+/*
+ *  Column j of A*B with the columns of A in registers
+ */
+static inline __m128 Column(__m128 a0,__m128 a1,__m128 a2,__m128 a3,const float* b)
+{
+   __m128 r = _mm_mul_ps(a0,_mm_set1_ps(b[0]));
+   r = _mm_add_ps(r,_mm_mul_ps(a1,_mm_set1_ps(b[1])));
+   r = _mm_add_ps(r,_mm_mul_ps(a2,_mm_set1_ps(b[2])));
+   return _mm_add_ps(r,_mm_mul_ps(a3,_mm_set1_ps(b[3])));
+}
+#endif
+
+/*
+ *  R = A*B (R may be A or B)
+ */
+void Mat4Multiply(mat4 R,const mat4 A,const mat4 B)
+{
+#ifdef SIMD
+   __m128 a0 = _mm_loadu_ps(A);
+   __m128 a1 = _mm_loadu_ps(A+4);
+   __m128 a2 = _mm_loadu_ps(A+8);
+   __m128 a3 = _mm_loadu_ps(A+12);
+   //  Column j of R only reads column j of B
+   _mm_storeu_ps(R   ,Column(a0,a1,a2,a3,B));
+   _mm_storeu_ps(R+4 ,Column(a0,a1,a2,a3,B+4));
+   _mm_storeu_ps(R+8 ,Column(a0,a1,a2,a3,B+8));
+   _mm_storeu_ps(R+12,Column(a0,a1,a2,a3,B+12));
+#else
+   int i,j;
+   mat4 T;
+   for (j=0;j<4;j++)
+      for (i=0;i<4;i++)
+         T[4*j+i] = A[i]*B[4*j] + A[4+i]*B[4*j+1] + A[8+i]*B[4*j+2] + A[12+i]*B[4*j+3];
+   memcpy(R,T,sizeof(mat4));
+#endif
+}
+
+/*
+ *  R[k] = A*B[k] for n matrixes, e.g. the modelview of each object
+ */
+void Mat4MultiplyN(mat4 R[],const mat4 A,const mat4 B[],int n)
+{
+#ifdef SIMD
+   int k;
+   __m128 a0 = _mm_loadu_ps(A);
+   __m128 a1 = _mm_loadu_ps(A+4);
+   __m128 a2 = _mm_loadu_ps(A+8);
+   __m128 a3 = _mm_loadu_ps(A+12);
+   for (k=0;k<n;k++)
+   {
+      _mm_storeu_ps(R[k]   ,Column(a0,a1,a2,a3,B[k]));
+      _mm_storeu_ps(R[k]+4 ,Column(a0,a1,a2,a3,B[k]+4));
+      _mm_storeu_ps(R[k]+8 ,Column(a0,a1,a2,a3,B[k]+8));
+      _mm_storeu_ps(R[k]+12,Column(a0,a1,a2,a3,B[k]+12));
+   }
+#else
+   int k;
+   for (k=0;k<n;k++)
+      Mat4Multiply(R[k],A,B[k]);
+#endif
+}
+
+/*
+ *  r = M*v (r may be v)
+ */
+void Mat4Transform(vec4 r,const mat4 M,const vec4 v)
+{
+#ifdef SIMD
+   _mm_storeu_ps(r,Column(_mm_loadu_ps(M),_mm_loadu_ps(M+4),_mm_loadu_ps(M+8),_mm_loadu_ps(M+12),v));
+#else
+   int i;
+   vec4 t;
+   for (i=0;i<4;i++)
+      t[i] = M[i]*v[0] + M[4+i]*v[1] + M[8+i]*v[2] + M[12+i]*v[3];
+   memcpy(r,t,sizeof(vec4));
+#endif
+}
+
+/*
+ *  M = M*translation
+ */
+void Mat4Translate(mat4 M,float x,float y,float z)
+{
+#ifdef SIMD
+   __m128 c = _mm_mul_ps(_mm_loadu_ps(M),_mm_set1_ps(x));
+   c = _mm_add_ps(c,_mm_mul_ps(_mm_loadu_ps(M+4),_mm_set1_ps(y)));
+   c = _mm_add_ps(c,_mm_mul_ps(_mm_loadu_ps(M+8),_mm_set1_ps(z)));
+   _mm_storeu_ps(M+12,_mm_add_ps(c,_mm_loadu_ps(M+12)));
+#else
+   int i;
+   for (i=0;i<4;i++)
+      M[12+i] = M[i]*x + M[4+i]*y + M[8+i]*z + M[12+i];
+#endif
+}
+
+/*
+ *  M = M*scale
+ */
+void Mat4Scale(mat4 M,float x,float y,float z)
+{
+   int i;
+   for (i=0;i<4;i++)
+   {
+      M[i]   *= x;
+      M[4+i] *= y;
+      M[8+i] *= z;
+   }
+}
+
+/*
+ *  M = M*rotation by th degrees about (x,y,z)
+ */
+void Mat4Rotate(mat4 M,float th,float x,float y,float z)
+{
+   mat4  R;
+   float s = sin(th*RAD);
+   float c = cos(th*RAD);
+   float l = sqrt(x*x+y*y+z*z);
+   if (l==0) return;
+   x /= l;
+   y /= l;
+   z /= l;
+   //  The diagonal is written so rotations about an axis keep an exact 1
+   R[0] = x*x+(1-x*x)*c; R[4] = x*y*(1-c)-z*s; R[8]  = z*x*(1-c)+y*s; R[12] = 0;
+   R[1] = x*y*(1-c)+z*s; R[5] = y*y+(1-y*y)*c; R[9]  = y*z*(1-c)-x*s; R[13] = 0;
+   R[2] = z*x*(1-c)-y*s; R[6] = y*z*(1-c)+x*s; R[10] = z*z+(1-z*z)*c; R[14] = 0;
+   R[3] = 0;             R[7] = 0;             R[11] = 0;             R[15] = 1;
+   Mat4Multiply(M,M,R);
+}
+
+/*
+ *  Perspective projection (as gluPerspective)
+ *    Worked out in double precision like GLU
+ */
+void Mat4Perspective(mat4 M,double fov,double asp,double zn,double zf)
+{
+   double f = cos(fov*RAD/2)/sin(fov*RAD/2);
+   memset(M,0,sizeof(mat4));
+   M[0]  = f/asp;
+   M[5]  = f;
+   M[10] = (zf+zn)/(zn-zf);
+   M[11] = -1;
+   M[14] = 2*zf*zn/(zn-zf);
+}
+
+/*
+ *  Orthogonal projection (as glOrtho)
+ */
+void Mat4Ortho(mat4 M,float l,float r,float b,float t,float n,float f)
+{
+   memset(M,0,sizeof(mat4));
+   M[0]  = 2/(r-l);
+   M[5]  = 2/(t-b);
+   M[10] = -2/(f-n);
+   M[12] = -(r+l)/(r-l);
+   M[13] = -(t+b)/(t-b);
+   M[14] = -(f+n)/(f-n);
+   M[15] = 1;
+}
+
+/*
+ *  The projection Project sets
+ */
+void Mat4Project(mat4 M,double fov,double asp,double dim)
+{
+   if (fov)
+      Mat4Perspective(M,fov,asp,dim/8,8*dim);
+   else
+      Mat4Ortho(M,-asp*dim,asp*dim,-dim,+dim,-dim,+dim);
+}
+
+/*
+ *  Normalize a vector (left alone if zero)
+ */
+static void Normalize(vec3 v)
+{
+   float l = sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+   if (l==0) return;
+   v[0] /= l;
+   v[1] /= l;
+   v[2] /= l;
+}
+
+/*
+ *  c = a x b
+ */
+static void Cross(vec3 c,const vec3 a,const vec3 b)
+{
+   c[0] = a[1]*b[2] - a[2]*b[1];
+   c[1] = a[2]*b[0] - a[0]*b[2];
+   c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+/*
+ *  Viewing matrix (as gluLookAt)
+ */
+void Mat4LookAt(mat4 M,double ex,double ey,double ez,double cx,double cy,double cz,double ux,double uy,double uz)
+{
+   vec3 f = {cx-ex,cy-ey,cz-ez};
+   vec3 u = {ux,uy,uz};
+   vec3 s;
+   Normalize(f);
+   //  Side = forward x up, then up = side x forward
+   Cross(s,f,u);
+   Normalize(s);
+   Cross(u,s,f);
+   M[0] = s[0]; M[4] = s[1]; M[8]  = s[2]; M[12] = 0;
+   M[1] = u[0]; M[5] = u[1]; M[9]  = u[2]; M[13] = 0;
+   M[2] =-f[0]; M[6] =-f[1]; M[10] =-f[2]; M[14] = 0;
+   M[3] = 0;    M[7] = 0;    M[11] = 0;    M[15] = 1;
+   //  Move the eye to the origin
+   Mat4Translate(M,-ex,-ey,-ez);
+}
+
+/*
+ *  R = inverse of M (R may be M), e.g. to turn a mouse position into a ray
+ *    Returns 0 if M is singular
+ */
+int Mat4Invert(mat4 R,const mat4 M)
+{
+   mat4  T;
+   float det;
+   int   k;
+   T[0]  =  M[5]*M[10]*M[15] - M[5]*M[11]*M[14] - M[9]*M[6]*M[15] + M[9]*M[7]*M[14] + M[13]*M[6]*M[11] - M[13]*M[7]*M[10];
+   T[4]  = -M[4]*M[10]*M[15] + M[4]*M[11]*M[14] + M[8]*M[6]*M[15] - M[8]*M[7]*M[14] - M[12]*M[6]*M[11] + M[12]*M[7]*M[10];
+   T[8]  =  M[4]*M[9]*M[15]  - M[4]*M[11]*M[13] - M[8]*M[5]*M[15] + M[8]*M[7]*M[13] + M[12]*M[5]*M[11] - M[12]*M[7]*M[9];
+   T[12] = -M[4]*M[9]*M[14]  + M[4]*M[10]*M[13] + M[8]*M[5]*M[14] - M[8]*M[6]*M[13] - M[12]*M[5]*M[10] + M[12]*M[6]*M[9];
+   T[1]  = -M[1]*M[10]*M[15] + M[1]*M[11]*M[14] + M[9]*M[2]*M[15] - M[9]*M[3]*M[14] - M[13]*M[2]*M[11] + M[13]*M[3]*M[10];
+   T[5]  =  M[0]*M[10]*M[15] - M[0]*M[11]*M[14] - M[8]*M[2]*M[15] + M[8]*M[3]*M[14] + M[12]*M[2]*M[11] - M[12]*M[3]*M[10];
+   T[9]  = -M[0]*M[9]*M[15]  + M[0]*M[11]*M[13] + M[8]*M[1]*M[15] - M[8]*M[3]*M[13] - M[12]*M[1]*M[11] + M[12]*M[3]*M[9];
+   T[13] =  M[0]*M[9]*M[14]  - M[0]*M[10]*M[13] - M[8]*M[1]*M[14] + M[8]*M[2]*M[13] + M[12]*M[1]*M[10] - M[12]*M[2]*M[9];
+   T[2]  =  M[1]*M[6]*M[15]  - M[1]*M[7]*M[14]  - M[5]*M[2]*M[15] + M[5]*M[3]*M[14] + M[13]*M[2]*M[7]  - M[13]*M[3]*M[6];
+   T[6]  = -M[0]*M[6]*M[15]  + M[0]*M[7]*M[14]  + M[4]*M[2]*M[15] - M[4]*M[3]*M[14] - M[12]*M[2]*M[7]  + M[12]*M[3]*M[6];
+   T[10] =  M[0]*M[5]*M[15]  - M[0]*M[7]*M[13]  - M[4]*M[1]*M[15] + M[4]*M[3]*M[13] + M[12]*M[1]*M[7]  - M[12]*M[3]*M[5];
+   T[14] = -M[0]*M[5]*M[14]  + M[0]*M[6]*M[13]  + M[4]*M[1]*M[14] - M[4]*M[2]*M[13] - M[12]*M[1]*M[6]  + M[12]*M[2]*M[5];
+   T[3]  = -M[1]*M[6]*M[11]  + M[1]*M[7]*M[10]  + M[5]*M[2]*M[11] - M[5]*M[3]*M[10] - M[9]*M[2]*M[7]   + M[9]*M[3]*M[6];
+   T[7]  =  M[0]*M[6]*M[11]  - M[0]*M[7]*M[10]  - M[4]*M[2]*M[11] + M[4]*M[3]*M[10] + M[8]*M[2]*M[7]   - M[8]*M[3]*M[6];
+   T[11] = -M[0]*M[5]*M[11]  + M[0]*M[7]*M[9]   + M[4]*M[1]*M[11] - M[4]*M[3]*M[9]  - M[8]*M[1]*M[7]   + M[8]*M[3]*M[5];
+   T[15] =  M[0]*M[5]*M[10]  - M[0]*M[6]*M[9]   - M[4]*M[1]*M[10] + M[4]*M[2]*M[9]  + M[8]*M[1]*M[6]   - M[8]*M[2]*M[5];
+   det = M[0]*T[0] + M[1]*T[4] + M[2]*T[8] + M[3]*T[12];
+   if (det==0) return 0;
+   for (k=0;k<16;k++)
+      R[k] = T[k]/det;
+   return 1;
+}
+
+/*
+ *  Planes of the view frustum from a projection times view matrix
+ *    Each plane is (a,b,c,d) with ax+by+cz+d>=0 inside and |(a,b,c)|=1
+ */
+void Mat4Frustum(vec4 plane[6],const mat4 M)
+{
+   int i,k;
+   for (k=0;k<6;k++)
+   {
+      //  Row 3 plus or minus rows 0 (left,right) 1 (bottom,top) and 2 (near,far)
+      float sign = (k&1) ? -1 : 1;
+      float len;
+      for (i=0;i<4;i++)
+         plane[k][i] = M[4*i+3] + sign*M[4*i+k/2];
+      len = sqrt(plane[k][0]*plane[k][0]+plane[k][1]*plane[k][1]+plane[k][2]*plane[k][2]);
+      if (len>0)
+         for (i=0;i<4;i++)
+            plane[k][i] /= len;
+   }
+}
+
+/*
+ *  Is any part of a sphere inside the frustum
+ */
+int SphereVisible(const vec4 plane[6],float x,float y,float z,float r)
+{
+   int k;
+   for (k=0;k<6;k++)
+      if (plane[k][0]*x + plane[k][1]*y + plane[k][2]*z + plane[k][3] < -r)
+         return 0;
+   return 1;
+}
+
+/*
+ *  Rotation by th degrees about (x,y,z)
+ */
+void QuatAxis(quat q,float th,float x,float y,float z)
+{
+   float l = sqrt(x*x+y*y+z*z);
+   float s = l>0 ? sin(th*RAD/2)/l : 0;
+   q[0] = x*s;
+   q[1] = y*s;
+   q[2] = z*s;
+   q[3] = cos(th*RAD/2);
+}
+
+/*
+ *  r = a*b, the rotation b then a (r may be a or b)
+ */
+void QuatMultiply(quat r,const quat a,const quat b)
+{
+   quat t;
+   t[0] = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+   t[1] = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+   t[2] = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+   t[3] = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+   memcpy(r,t,sizeof(quat));
+}
+
+/*
+ *  Spherical interpolation from a (t=0) to b (t=1) the short way round
+ */
+void QuatSlerp(quat r,const quat a,const quat b,float t)
+{
+   float d = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+   float sb = d<0 ? -1 : 1;
+   float wa,wb;
+   int   k;
+   d *= sb;
+   //  Nearly the same rotation - interpolate linearly
+   if (d>0.9995)
+   {
+      wa = 1-t;
+      wb = t;
+   }
+   else
+   {
+      float th = acos(d);
+      wa = sin((1-t)*th)/sin(th);
+      wb = sin(t*th)/sin(th);
+   }
+   for (k=0;k<4;k++)
+      r[k] = wa*a[k] + sb*wb*b[k];
+   //  Renormalize
+   d = sqrt(r[0]*r[0]+r[1]*r[1]+r[2]*r[2]+r[3]*r[3]);
+   for (k=0;k<4;k++)
+      r[k] /= d;
+}
+
+/*
+ *  Rotation matrix of a unit quaternion
+ */
+void QuatMat4(mat4 M,const quat q)
+{
+   float x=q[0],y=q[1],z=q[2],w=q[3];
+   M[0] = 1-2*(y*y+z*z); M[4] = 2*(x*y-z*w);   M[8]  = 2*(x*z+y*w);   M[12] = 0;
+   M[1] = 2*(x*y+z*w);   M[5] = 1-2*(x*x+z*z); M[9]  = 2*(y*z-x*w);   M[13] = 0;
+   M[2] = 2*(x*z-y*w);   M[6] = 2*(y*z+x*w);   M[10] = 1-2*(x*x+y*y); M[14] = 0;
+   M[3] = 0;             M[7] = 0;             M[11] = 0;             M[15] = 1;
+}
@@ -263,6 +263,7 @@ int LoadOBJ(const char* file)
    float* T;       //  Array if textures coordinates
    char*  line;    //  Line pointer
    char*  str;     //  String pointer
+   Trace("LoadOBJ");
 
    //  Open file
    FILE* f = fopen(file,"r");
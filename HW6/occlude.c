@@ -0,0 +1,305 @@
+/*
+ *  Software occlusion culling with a hierarchical depth buffer
+ *
+ *  Large boxes in view are drawn into a small depth buffer on the CPU
+ *  and the bounds of everything else are tested against it before they
+ *  are queued, so objects hidden behind nearer buildings are never sent
+ *  to OpenGL.  Nothing is read back from the GPU, so it works the same
+ *  with any driver.
+ *
+ *  The test is conservative.  An occluder only covers the pixels that
+ *  lie entirely inside its outline, and covers them at the depth of its
+ *  farthest corner.  An object is hidden only if the nearest corner of
+ *  its bounding box is behind every occluder pixel in the rectangle
+ *  around that box on the screen.  Depths are normalized device z, which
+ *  grows with distance for perspective and orthogonal projections alike.
+ *
+ *  The buffer is split into bands of rows that are filled as jobs, with
+ *  SSE for the spans.  Each level of the pyramid above it keeps the
+ *  farthest depth of four pixels below, so an object is tested against
+ *  at most four values of the level where its box fits in two by two.
+ */
+#include "CSCIx229.h"
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SIMD
+#endif
+
+#define MAXOCC 256  //  Occluders per frame
+#define BAND   8    //  Rows filled by one job
+#define LEVELS 8    //  Pyramid levels
+
+//  Occluder outline in buffer pixels and its far depth
+typedef struct
+{
+   int   n;
+   float x[8],y[8];   //  Convex outline, counterclockwise
+   float y0,y1;       //  Rows it spans
+   float z;           //  Farthest depth
+} occluder_t;
+
+struct occlusion_t
+{
+   int        w[LEVELS],h[LEVELS];  //  Size of each level
+   float*     depth[LEVELS];        //  Farthest visible depth
+   int        levels;
+   mat4       PV;                   //  Projection * view
+   occluder_t occ[MAXOCC];
+   int        n;
+};
+
+/*
+ *  New occlusion buffer of w x h pixels
+ *    The pyramid stops at the first odd size, so powers of two work best
+ */
+occlusion_t* OcclusionCreate(int w,int h)
+{
+   int k;
+   occlusion_t* o = (occlusion_t*)calloc(1,sizeof(occlusion_t));
+   if (!o) Fatal("Cannot allocate occlusion buffer\n");
+   if (w<1 || h<1) Fatal("Occlusion buffer cannot be %dx%d\n",w,h);
+   for (k=0;k<LEVELS;k++)
+   {
+      o->w[k] = w;
+      o->h[k] = h;
+      o->depth[k] = (float*)malloc(w*h*sizeof(float));
+      if (!o->depth[k]) Fatal("Cannot allocate %dx%d occlusion buffer\n",w,h);
+      o->levels++;
+      if (w%2 || h%2) break;
+      w /= 2;
+      h /= 2;
+   }
+   return o;
+}
+
+/*
+ *  Start a frame with no occluders
+ */
+void OcclusionBegin(occlusion_t* o,const mat4 PV)
+{
+   memcpy(o->PV,PV,sizeof(mat4));
+   o->n = 0;
+}
+
+/*
+ *  Project a point to buffer pixels and depth
+ *    Returns 0 if it is behind the near plane
+ */
+static int ToPixel(const occlusion_t* o,float x,float y,float z,float* p)
+{
+   vec4 v = {x,y,z,1},c;
+   Mat4Transform(c,o->PV,v);
+   if (c[3]<=0 || c[2]<-c[3]) return 0;
+   p[0] = (0.5*c[0]/c[3]+0.5)*o->w[0];
+   p[1] = (0.5*c[1]/c[3]+0.5)*o->h[0];
+   p[2] = c[2]/c[3];
+   return 1;
+}
+
+/*
+ *  Cross product of (b-a) and (c-a), positive if counterclockwise
+ */
+static float Turn(const float* a,const float* b,const float* c)
+{
+   return (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+}
+
+static int ComparePoint(const void* a,const void* b)
+{
+   const float* p = (const float*)a;
+   const float* q = (const float*)b;
+   return p[0]<q[0] ? -1 : p[0]>q[0] ? 1 : p[1]<q[1] ? -1 : p[1]>q[1];
+}
+
+/*
+ *  Add the box from -1 to 1 in a model matrix as an occluder
+ *    Boxes that reach behind the near plane are left out
+ */
+void OcclusionBox(occlusion_t* o,const mat4 model)
+{
+   float p[8][3],hull[16][3];
+   int   k,n=0,m;
+   occluder_t* q;
+   if (o->n==MAXOCC) return;
+   q = o->occ+o->n;
+   q->z = -1;
+   for (k=0;k<8;k++)
+   {
+      vec4 v = {k&1?1:-1,k&2?1:-1,k&4?1:-1,1},w;
+      Mat4Transform(w,model,v);
+      if (!ToPixel(o,w[0],w[1],w[2],p[k])) return;
+      if (p[k][2]>q->z) q->z = p[k][2];
+   }
+   //  Outline of the corners (monotone chain convex hull)
+   qsort(p,8,sizeof(p[0]),ComparePoint);
+   for (k=0;k<8;k++)
+   {
+      while (n>=2 && Turn(hull[n-2],hull[n-1],p[k])<=0) n--;
+      memcpy(hull[n++],p[k],sizeof(p[k]));
+   }
+   for (k=6,m=n+1;k>=0;k--)
+   {
+      while (n>=m && Turn(hull[n-2],hull[n-1],p[k])<=0) n--;
+      memcpy(hull[n++],p[k],sizeof(p[k]));
+   }
+   n--;
+   if (n<3) return;
+   q->n = n;
+   q->y0 = q->y1 = hull[0][1];
+   for (k=0;k<n;k++)
+   {
+      q->x[k] = hull[k][0];
+      q->y[k] = hull[k][1];
+      if (q->y[k]<q->y0) q->y0 = q->y[k];
+      if (q->y[k]>q->y1) q->y1 = q->y[k];
+   }
+   o->n++;
+}
+
+/*
+ *  Span of the outline on the line at height y
+ *    Returns 0 if the line misses it
+ */
+static int Span(const occluder_t* q,float y,float* xl,float* xr)
+{
+   int k;
+   if (y<q->y0 || y>q->y1) return 0;
+   *xl = 1e30;
+   *xr = -1e30;
+   for (k=0;k<q->n;k++)
+   {
+      int   j = (k+1)%q->n;
+      float ya=q->y[k],yb=q->y[j];
+      if ((y<ya && y<yb) || (y>ya && y>yb)) continue;
+      float x = ya==yb ? q->x[k] : q->x[k]+(y-ya)*(q->x[j]-q->x[k])/(yb-ya);
+      if (x<*xl) *xl = x;
+      if (x>*xr) *xr = x;
+      if (ya==yb)
+      {
+         if (q->x[j]<*xl) *xl = q->x[j];
+         if (q->x[j]>*xr) *xr = q->x[j];
+      }
+   }
+   return *xl<=*xr;
+}
+
+/*
+ *  Fill a band of rows with every occluder
+ */
+static void Band(int b0,int b1,void* arg)
+{
+   occlusion_t* o = (occlusion_t*)arg;
+   int w=o->w[0],h=o->h[0];
+   int y,k,y0=b0*BAND,y1=b1*BAND<h ? b1*BAND : h;
+   //  Clear to the far plane
+   for (y=y0;y<y1;y++)
+      for (k=0;k<w;k++)
+         o->depth[0][y*w+k] = 1;
+   for (k=0;k<o->n;k++)
+   {
+      const occluder_t* q = o->occ+k;
+      int ya = q->y0<y0 ? y0 : (int)ceil(q->y0);
+      int yb = q->y1>y1 ? y1 : (int)floor(q->y1);
+      for (y=ya;y<yb;y++)
+      {
+         float l0,r0,l1,r1;
+         float* row = o->depth[0]+y*w;
+         int    x,x0,x1;
+         //  Pixels entirely inside: the outline is convex, so the
+         //  narrowest span is at the top or bottom of the row
+         if (!Span(q,y,&l0,&r0) || !Span(q,y+1,&l1,&r1)) continue;
+         x0 = (int)ceil(l0>l1 ? l0 : l1);
+         x1 = (int)floor(r0<r1 ? r0 : r1);
+         if (x0<0) x0 = 0;
+         if (x1>w) x1 = w;
+         x = x0;
+#ifdef SIMD
+         __m128 z = _mm_set1_ps(q->z);
+         for (;x<x1 && (x&3);x++)
+            if (q->z<row[x]) row[x] = q->z;
+         for (;x+4<=x1;x+=4)
+            _mm_storeu_ps(row+x,_mm_min_ps(_mm_loadu_ps(row+x),z));
+#endif
+         for (;x<x1;x++)
+            if (q->z<row[x]) row[x] = q->z;
+      }
+   }
+}
+
+/*
+ *  Draw the occluders and build the pyramid
+ */
+void OcclusionRender(occlusion_t* o)
+{
+   int k,x,y;
+   Trace("OcclusionRender");
+   JobFor((o->h[0]+BAND-1)/BAND,1,Band,o);
+   //  Each level keeps the farthest of four pixels below
+   for (k=1;k<o->levels;k++)
+   {
+      const float* a = o->depth[k-1];
+      float*       d = o->depth[k];
+      int          w = o->w[k],wa = o->w[k-1];
+      for (y=0;y<o->h[k];y++)
+      {
+         const float* r0 = a+2*y*wa;
+         const float* r1 = r0+wa;
+         x = 0;
+#ifdef SIMD
+         for (;x+4<=w;x+=4)
+         {
+            __m128 m0 = _mm_max_ps(_mm_loadu_ps(r0+2*x),_mm_loadu_ps(r1+2*x));
+            __m128 m1 = _mm_max_ps(_mm_loadu_ps(r0+2*x+4),_mm_loadu_ps(r1+2*x+4));
+            __m128 ev = _mm_shuffle_ps(m0,m1,_MM_SHUFFLE(2,0,2,0));
+            __m128 od = _mm_shuffle_ps(m0,m1,_MM_SHUFFLE(3,1,3,1));
+            _mm_storeu_ps(d+y*w+x,_mm_max_ps(ev,od));
+         }
+#endif
+         for (;x<w;x++)
+         {
+            float m = r0[2*x];
+            if (r0[2*x+1]>m) m = r0[2*x+1];
+            if (r1[2*x]>m)   m = r1[2*x];
+            if (r1[2*x+1]>m) m = r1[2*x+1];
+            d[y*w+x] = m;
+         }
+      }
+   }
+}
+
+/*
+ *  Can any part of the box from -1 to 1 in a model matrix be seen past
+ *  the occluders
+ */
+int OcclusionVisible(const occlusion_t* o,const mat4 model)
+{
+   float x0=1e30,x1=-1e30,y0=1e30,y1=-1e30,zn=1e30,m=-1;
+   int   k,i,j,i0,i1,j0,j1,l=0;
+   //  Rectangle around the box on the screen and its nearest depth
+   for (k=0;k<8;k++)
+   {
+      float p[3];
+      vec4 v = {k&1?1:-1,k&2?1:-1,k&4?1:-1,1},w;
+      Mat4Transform(w,model,v);
+      if (!ToPixel(o,w[0],w[1],w[2],p)) return 1;
+      if (p[0]<x0) x0 = p[0];
+      if (p[0]>x1) x1 = p[0];
+      if (p[1]<y0) y0 = p[1];
+      if (p[1]>y1) y1 = p[1];
+      if (p[2]<zn) zn = p[2];
+   }
+   //  Pixels under the box (off screen counts as not hidden)
+   if (x0<0 || y0<0 || x1>o->w[0] || y1>o->h[0]) return 1;
+   i0 = (int)x0; i1 = (int)x1;
+   j0 = (int)y0; j1 = (int)y1;
+   if (i1>=o->w[0]) i1 = o->w[0]-1;
+   if (j1>=o->h[0]) j1 = o->h[0]-1;
+   //  Coarsest level where the box covers at most two by two pixels
+   while (l+1<o->levels && ((i1>>l)-(i0>>l)>=2 || (j1>>l)-(j0>>l)>=2))
+      l++;
+   for (j=j0>>l;j<=j1>>l;j++)
+      for (i=i0>>l;i<=i1>>l;i++)
+         if (o->depth[l][j*o->w[l]+i]>m)
+            m = o->depth[l][j*o->w[l]+i];
+   return zn<=m;
+}
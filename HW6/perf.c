@@ -0,0 +1,252 @@
+/*
+ *  GPU pass timing and performance overlay
+ *
+ *  PerfFrame/PerfFrameEnd bracket a frame and PerfBegin/PerfEnd a pass
+ *  within it with GL_TIMESTAMP queries.  Queries rotate through
+ *  PERF_FRAMES sets, and a set is read when it comes around again, so
+ *  the results are a few frames old but reading them never waits for
+ *  the GPU.  A set that is still not ready then is dropped.
+ *
+ *  PerfOverlay draws a frame time graph with the GPU time of each pass
+ *  and the draw calls and triangles of the last frame.  The render queue
+ *  and GPU culling add theirs with PerfDraws once per flush, so the
+ *  counts cost nothing per shape and need no GLCOUNT build.
+ */
+#include "CSCIx229.h"
+#include <time.h>
+
+#define PERF_FRAMES  4    //  Query sets in flight
+#define PERF_PASSES  8    //  Passes per frame (pass 0 is the whole frame)
+#define PERF_HISTORY 120  //  Frames in the graph
+
+//  Query set for one frame
+typedef struct
+{
+   GLuint q[PERF_PASSES][2];    //  Begin and end timestamps
+   int    used[PERF_PASSES];    //  Passes issued
+   int    pending;              //  Waiting to be read
+} set_t;
+
+static int    timers=-1;                //  Timer queries supported
+static set_t  sets[PERF_FRAMES];
+static int    frame=0;                  //  Frame counter
+static const char* pass[PERF_PASSES];   //  Pass names
+static int    npass=1;
+static double gpu[PERF_PASSES];         //  Smoothed GPU ms per pass
+static double cpuHist[PERF_HISTORY];    //  Frame interval history (ms)
+static double gpuHist[PERF_HISTORY];    //  GPU frame history (ms)
+static double last=0;                   //  Time of the last frame (ms)
+static int    draws=0,triangles=0;      //  This frame
+static int    lastDraws=0,lastTriangles=0;  //  Last frame
+
+/*
+ *  Wall clock time in ms
+ */
+static double Now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return 1e3*ts.tv_sec + 1e-6*ts.tv_nsec;
+}
+
+/*
+ *  Create the queries if the driver has timestamps
+ */
+static void Init(void)
+{
+   int k,major=0,minor=0;
+   const char* ver = (const char*)glGetString(GL_VERSION);
+   const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+   if (ver) sscanf(ver,"%d.%d",&major,&minor);
+   timers = major>3 || (major==3 && minor>=3) || (ext && strstr(ext,"GL_ARB_timer_query"));
+#ifdef GL_TIMESTAMP
+   if (timers)
+      for (k=0;k<PERF_FRAMES;k++)
+         glGenQueries(2*PERF_PASSES,sets[k].q[0]);
+#else
+   timers = 0;
+#endif
+   pass[0] = "frame";
+}
+
+/*
+ *  Read the results of a query set if they are ready
+ */
+static void Read(set_t* s)
+{
+#ifdef GL_TIMESTAMP
+   int    k;
+   GLint  ready=0;
+   GLuint64 t0,t1;
+   glGetQueryObjectiv(s->q[0][1],GL_QUERY_RESULT_AVAILABLE,&ready);
+   if (ready)
+   {
+      for (k=0;k<npass;k++)
+         if (s->used[k])
+         {
+            glGetQueryObjectui64v(s->q[k][0],GL_QUERY_RESULT,&t0);
+            glGetQueryObjectui64v(s->q[k][1],GL_QUERY_RESULT,&t1);
+            //  Smooth over about ten frames
+            gpu[k] = gpu[k]>0 ? 0.9*gpu[k]+0.1e-6*(t1-t0) : 1e-6*(t1-t0);
+            if (k==0) gpuHist[frame%PERF_HISTORY] = 1e-6*(t1-t0);
+         }
+   }
+#endif
+   s->pending = 0;
+}
+
+/*
+ *  Start a frame
+ */
+void PerfFrame(void)
+{
+   double t = Now();
+   set_t* s;
+   if (timers<0) Init();
+   //  Frame interval of the last frame
+   frame++;
+   cpuHist[frame%PERF_HISTORY] = last>0 ? t-last : 0;
+   gpuHist[frame%PERF_HISTORY] = 0;
+   last = t;
+   //  Reuse the oldest query set once its results are in
+   s = sets + frame%PERF_FRAMES;
+   if (s->pending) Read(s);
+   memset(s->used,0,sizeof(s->used));
+   draws = triangles = 0;
+   PerfBegin("frame");
+}
+
+/*
+ *  End a frame (before the overlay and buffer swap)
+ */
+void PerfFrameEnd(void)
+{
+   PerfEnd("frame");
+   lastDraws = draws;
+   lastTriangles = triangles;
+}
+
+/*
+ *  Count draw calls and triangles in this frame
+ */
+void PerfDraws(int n,int t)
+{
+   draws += n;
+   triangles += t;
+}
+
+/*
+ *  Pass index for a name (names are compared by pointer first)
+ */
+static int Pass(const char* name)
+{
+   int k;
+   for (k=0;k<npass;k++)
+      if (pass[k]==name || !strcmp(pass[k],name))
+         return k;
+   if (npass==PERF_PASSES) return -1;
+   pass[npass] = name;
+   return npass++;
+}
+
+/*
+ *  Bracket a GPU pass
+ */
+void PerfBegin(const char* name)
+{
+#ifdef GL_TIMESTAMP
+   int k = Pass(name);
+   set_t* s = sets + frame%PERF_FRAMES;
+   if (!timers || k<0) return;
+   glQueryCounter(s->q[k][0],GL_TIMESTAMP);
+#endif
+}
+
+void PerfEnd(const char* name)
+{
+#ifdef GL_TIMESTAMP
+   int k = Pass(name);
+   set_t* s = sets + frame%PERF_FRAMES;
+   if (!timers || k<0) return;
+   glQueryCounter(s->q[k][1],GL_TIMESTAMP);
+   s->used[k] = 1;
+   if (k==0) s->pending = 1;
+#endif
+}
+
+/*
+ *  Draw the overlay in the top left corner
+ */
+void PerfOverlay(void)
+{
+   const int W=2*PERF_HISTORY,H=80;  //  Graph size (pixels)
+   const double full=33.3;           //  ms at the top of the graph
+   int    k,x0,y0,vp[4];
+   double cpu=0,n=0;
+
+   glGetIntegerv(GL_VIEWPORT,vp);
+   x0 = 5;
+   y0 = vp[3]-H-5;
+
+   //  Pixel coordinates with no depth test, lighting or textures
+   glPushAttrib(GL_ENABLE_BIT|GL_CURRENT_BIT);
+   glDisable(GL_DEPTH_TEST);
+   glDisable(GL_LIGHTING);
+   glDisable(GL_TEXTURE_2D);
+   glMatrixMode(GL_PROJECTION);
+   glPushMatrix();
+   glLoadIdentity();
+   glOrtho(0,vp[2],0,vp[3],-1,1);
+   glMatrixMode(GL_MODELVIEW);
+   glPushMatrix();
+   glLoadIdentity();
+
+   //  Background and 60 Hz line
+   glColor3f(0.15,0.15,0.15);
+   glRecti(x0,y0,x0+W,y0+H);
+   glBegin(GL_LINES);
+   glColor3f(0.6,0.6,0);
+   glVertex2d(x0,y0+H*16.7/full);
+   glVertex2d(x0+W,y0+H*16.7/full);
+   //  Frame interval (white) and GPU time (green), oldest on the left
+   for (k=0;k<PERF_HISTORY;k++)
+   {
+      int    i = (frame+1+k)%PERF_HISTORY;
+      double c = fmin(cpuHist[i],full);
+      double g = fmin(gpuHist[i],full);
+      glColor3f(0.8,0.8,0.8);
+      glVertex2d(x0+2*k,y0);
+      glVertex2d(x0+2*k,y0+H*c/full);
+      glColor3f(0,1,0);
+      glVertex2d(x0+2*k+1,y0);
+      glVertex2d(x0+2*k+1,y0+H*g/full);
+      if (cpuHist[i]>0)
+      {
+         cpu += cpuHist[i];
+         n++;
+      }
+   }
+   glEnd();
+
+   glPopMatrix();
+   glMatrixMode(GL_PROJECTION);
+   glPopMatrix();
+   glMatrixMode(GL_MODELVIEW);
+
+   //  Numbers below the graph
+   glColor3f(1,1,1);
+   glWindowPos2i(x0,y0-20);
+   Print("Frame %.2f ms  Draws %d  Triangles %d",n?cpu/n:0,lastDraws,lastTriangles);
+   if (timers)
+      for (k=0;k<npass;k++)
+      {
+         glWindowPos2i(x0,y0-40-20*k);
+         Print("GPU %-10s %.3f ms",pass[k],gpu[k]);
+      }
+   else
+   {
+      glWindowPos2i(x0,y0-40);
+      Print("GPU timer queries not supported");
+   }
+   glPopAttrib();
+}
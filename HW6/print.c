@@ -1,20 +1,260 @@
 /*
  *  Convenience routine to output raster text
  *  Use VARARGS to make this more flexible
+ *
+ *  The font is drawn once with glutBitmapCharacter into a texture atlas.
+ *  After that each string is one batch of textured quads drawn at the
+ *  current raster position, instead of one glBitmap per character.  The
+ *  quads of recent strings are kept, so a HUD line that has not changed
+ *  since the last frame is drawn without being laid out again.
+ *
+ *  Print only queues the string at the raster position and color;
+ *  PrintFlush draws everything queued with one set of state changes, so
+ *  call it once per frame before swapping buffers.
  */
 #include "CSCIx229.h"
 
 #define LEN 8192  //  Maximum length of text string
+
+//  The atlas is drawn through a framebuffer object, which the Apple and
+//  Windows headers only declare as an extension
+#if (defined(__APPLE__) || defined(_WIN32)) && !defined(USEGLEW)
+#define NOATLAS
+#endif
+
+#ifndef NOATLAS
+#define FONT    GLUT_BITMAP_HELVETICA_18
+#define SIZE    18   //  Font size (pixels)
+#define FIRST   32   //  First character in the atlas
+#define LAST    126  //  Last character in the atlas
+#define COLS    16   //  Atlas cells across
+#define PAD     2    //  Cell room left of the pen
+#define STRINGS 32   //  Strings cached
+#define QUEUE   16   //  Strings queued (under STRINGS so none is evicted)
+
+//  Laid out string
+typedef struct
+{
+   char*    text;
+   unsigned hash;
+   unsigned used;     //  Print call that last drew it
+   int      n;        //  Quads
+   float*   v;        //  x,y,s,t for each quad corner
+   float    advance;  //  Pen movement
+} string_t;
+
+//  Queued string
+typedef struct
+{
+   string_t* s;
+   float     pos[4];    //  Window position
+   float     color[4];
+} text_t;
+
+static unsigned int atlas=0;          //  Font texture
+static int      cw,ch,base;           //  Cell size and baseline in the cell
+static int      aw,ah;                //  Atlas size
+static int      width[LAST+1];        //  Character advance
+static string_t cache[STRINGS];
+static unsigned calls=0;
+static text_t   queue[QUEUE];
+static int      queued=0;
+
+/*
+ *  Draw the font into the atlas
+ *    Returns 0 if there is no font (headless mode)
+ */
+static int Atlas(void)
+{
+   GLint  fbo0;
+   GLuint fbo;
+   int    k;
+   if (atlas) return 1;
+   //  Cells with room for half the size below the baseline and more above
+   cw = 0;
+   for (k=FIRST;k<=LAST;k++)
+   {
+      width[k] = glutBitmapWidth(FONT,k);
+      if (width[k]>cw) cw = width[k];
+   }
+   if (!cw) return 0;
+   base = SIZE/2;
+   ch = 2*SIZE;
+   cw += 2*PAD;
+   aw = COLS*cw;
+   ah = ((LAST-FIRST)/COLS+1)*ch;
+
+   //  Clear texture
+   glGenTextures(1,&atlas);
+   glPushAttrib(GL_ALL_ATTRIB_BITS);
+   glBindTexture(GL_TEXTURE_2D,atlas);
+   glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,aw,ah,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+   //  Draw the characters into it in white
+   glGetIntegerv(GL_FRAMEBUFFER_BINDING,&fbo0);
+   glGenFramebuffers(1,&fbo);
+   glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+   glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,atlas,0);
+   if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE) Fatal("Cannot draw font atlas\n");
+   glViewport(0,0,aw,ah);
+   glDisable(GL_SCISSOR_TEST);
+   glClearColor(0,0,0,0);
+   glClear(GL_COLOR_BUFFER_BIT);
+   glDisable(GL_TEXTURE_2D);
+   glDisable(GL_LIGHTING);
+   glDisable(GL_DEPTH_TEST);
+   glDisable(GL_ALPHA_TEST);
+   glDisable(GL_BLEND);
+   glDisable(GL_FOG);
+   glColor4f(1,1,1,1);
+   for (k=FIRST;k<=LAST;k++)
+   {
+      glWindowPos2i(((k-FIRST)%COLS)*cw+PAD,((k-FIRST)/COLS)*ch+base);
+      glutBitmapCharacter(FONT,k);
+   }
+   glBindFramebuffer(GL_FRAMEBUFFER,fbo0);
+   glDeleteFramebuffers(1,&fbo);
+   glPopAttrib();
+   return 1;
+}
+
+/*
+ *  Quads of a string, laid out again only if it is not cached
+ */
+static string_t* Layout(const char* text)
+{
+   unsigned   hash=2166136261u;
+   const char *c;
+   string_t*  s=cache;
+   float*     v;
+   float      x=0;
+   int        k;
+   //  Cached (otherwise reuse the least recently drawn)
+   for (c=text;*c;c++)
+      hash = (hash^(unsigned char)*c)*16777619u;
+   for (k=0;k<STRINGS;k++)
+   {
+      if (cache[k].text && cache[k].hash==hash && !strcmp(cache[k].text,text))
+      {
+         cache[k].used = calls;
+         return cache+k;
+      }
+      if (cache[k].used<s->used) s = cache+k;
+   }
+   free(s->text);
+   s->text = (char*)malloc(strlen(text)+1);
+   s->v = (float*)realloc(s->v,16*strlen(text)*sizeof(float));
+   if (!s->text || !s->v) Fatal("Cannot allocate text\n");
+   strcpy(s->text,text);
+   s->hash = hash;
+   s->used = calls;
+   //  One quad per character (the cells overlap but their edges are clear)
+   s->n = 0;
+   v = s->v;
+   for (c=text;*c;c++)
+   {
+      int   i = (unsigned char)*c;
+      float x0=x-PAD,y0=-base,s0,t0,s1,t1;
+      if (i<FIRST || i>LAST) continue;
+      s0 = (float)(((i-FIRST)%COLS)*cw)/aw;
+      t0 = (float)(((i-FIRST)/COLS)*ch)/ah;
+      s1 = s0+(float)cw/aw;
+      t1 = t0+(float)ch/ah;
+      float q[16] = {x0,y0,s0,t0 , x0+cw,y0,s1,t0 , x0+cw,y0+ch,s1,t1 , x0,y0+ch,s0,t1};
+      memcpy(v,q,sizeof(q));
+      v += 16;
+      s->n++;
+      x += width[i];
+   }
+   s->advance = x;
+   return s;
+}
+#endif
+
+/*
+ *  Draw the queued strings
+ */
+void PrintFlush(void)
+{
+#ifndef NOATLAS
+   GLint vp[4];
+   int   k;
+   if (!queued) return;
+   Trace("PrintFlush");
+   glGetIntegerv(GL_VIEWPORT,vp);
+
+   //  Draw the quads in window coordinates at the raster position and depth
+   //  (bitmaps start on the pixel the raster position is in)
+   glPushAttrib(GL_ENABLE_BIT|GL_TEXTURE_BIT|GL_CURRENT_BIT|GL_COLOR_BUFFER_BIT);
+   glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+   glMatrixMode(GL_PROJECTION);
+   glPushMatrix();
+   glLoadIdentity();
+   glOrtho(vp[0],vp[0]+vp[2],vp[1],vp[1]+vp[3],0,-1);
+   glMatrixMode(GL_MODELVIEW);
+   glPushMatrix();
+   glDisable(GL_LIGHTING);
+   glDisable(GL_BLEND);
+   glEnable(GL_ALPHA_TEST);
+   glAlphaFunc(GL_GREATER,0.5);
+   glEnable(GL_TEXTURE_2D);
+   glBindTexture(GL_TEXTURE_2D,atlas);
+   glTexEnvi(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_MODULATE);
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+   for (k=0;k<queued;k++)
+   {
+      text_t* t = queue+k;
+      glLoadIdentity();
+      glTranslatef(floor(t->pos[0]),floor(t->pos[1]),t->pos[2]);
+      glColor4fv(t->color);
+      glVertexPointer(2,GL_FLOAT,4*sizeof(float),t->s->v);
+      glTexCoordPointer(2,GL_FLOAT,4*sizeof(float),t->s->v+2);
+      glDrawArrays(GL_QUADS,0,4*t->s->n);
+   }
+   glPopMatrix();
+   glMatrixMode(GL_PROJECTION);
+   glPopMatrix();
+   glMatrixMode(GL_MODELVIEW);
+   glPopClientAttrib();
+   glPopAttrib();
+   queued = 0;
+#endif
+}
+
 void Print(const char* format , ...)
 {
    char    buf[LEN];
-   char*   ch=buf;
    va_list args;
+#ifndef NOATLAS
+   GLint   valid;
+   text_t* t;
+#else
+   char*   ch=buf;
+#endif
+   Trace("Print");
    //  Turn the parameters into a character string
    va_start(args,format);
    vsnprintf(buf,LEN,format,args);
    va_end(args);
+#ifdef NOATLAS
    //  Display the characters one at a time at the current raster position
    while (*ch)
       glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18,*ch++);
+#else
+   //  Text is skipped without a font or a valid raster position
+   if (!*buf || !Atlas()) return;
+   glGetIntegerv(GL_CURRENT_RASTER_POSITION_VALID,&valid);
+   if (!valid) return;
+   //  Queue it where the raster position is now
+   if (queued==QUEUE) PrintFlush();
+   t = queue+queued++;
+   glGetFloatv(GL_CURRENT_RASTER_POSITION,t->pos);
+   glGetFloatv(GL_CURRENT_RASTER_COLOR,t->color);
+   calls++;
+   t->s = Layout(buf);
+   //  Move the raster position along like glutBitmapCharacter
+   glBitmap(0,0,0,0,t->s->advance,0,NULL);
+#endif
 }
@@ -5,16 +5,12 @@
 
 void Project(double fov,double asp,double dim)
 {
+   //  Perspective or orthogonal transformation worked out on the CPU
+   mat4 P;
+   Mat4Project(P,fov,asp,dim);
    //  Tell OpenGL we want to manipulate the projection matrix
    glMatrixMode(GL_PROJECTION);
-   //  Undo previous transformations
-   glLoadIdentity();
-   //  Perspective transformation
-   if (fov)
-      gluPerspective(fov,asp,dim/8,8*dim);
-   //  Orthogonal transformation
-   else
-      glOrtho(-asp*dim,asp*dim,-dim,+dim,-dim,+dim);
+   glLoadMatrixf(P);
    //  Switch to manipulating the model matrix
    glMatrixMode(GL_MODELVIEW);
    //  Undo previous transformations
@@ -0,0 +1,268 @@
+/*
+ *  Render queue for opaque shapes
+ *
+ *  Shapes are submitted as packets with a 64 bit sort key
+ *    bits 56-63  shader (always 0 with the fixed function pipeline)
+ *    bits 40-55  texture
+ *    bits 24-39  material
+ *    bits  0-23  eye space depth, so each group draws front to back
+ *  Each packet keeps its model matrix.  QueueEnd multiplies them all by
+ *  the view matrix in one batch and radix sorts the packets, and
+ *  QueueFlush draws them in key order, loading each modelview with
+ *  glLoadMatrixf and binding textures and setting materials only when
+ *  they change.
+ *
+ *  Filling and ending a queue makes no OpenGL calls, so a queue can be
+ *  prepared on any thread while another is being drawn.  QueueFlush must
+ *  run on the thread with the OpenGL context.
+ */
+#include "CSCIx229.h"
+
+//  Draw packet
+typedef struct
+{
+   int          shape;
+   unsigned int texture;
+   int          material;
+   int          detail;    //  Tessellation step (degrees)
+   int          numc,numt; //  Half torus rings and segments
+} packet_t;
+
+//  Sort entry
+typedef struct
+{
+   unsigned long long key;
+   int                packet;
+} entry_t;
+
+#define MAXMAT 256  //  Distinct materials per frame
+
+struct queue_t
+{
+   packet_t* packets;            //  Packets this frame
+   mat4*     model;              //  Model matrix of each packet
+   mat4*     mv;                 //  Modelview matrix of each packet
+   entry_t*  keys[2];            //  Sort keys and scratch
+   entry_t*  sorted;             //  Keys in order once the queue is ended
+   int       Npackets,Mpackets;
+   float     matShiny[MAXMAT];   //  Materials this frame
+   int       matEmit[MAXMAT];
+   int       Nmat,material;
+   int       detail;             //  Tessellation step for new packets
+   mat4      view;               //  View matrix at QueueBegin
+};
+
+/*
+ *  New empty queue
+ */
+queue_t* QueueCreate(void)
+{
+   queue_t* q = (queue_t*)calloc(1,sizeof(queue_t));
+   if (!q) Fatal("Cannot allocate render queue\n");
+   return q;
+}
+
+/*
+ *  Start a frame with the view matrix the packets will be drawn with
+ */
+void QueueBegin(queue_t* q,const mat4 view)
+{
+   q->Npackets = 0;
+   q->Nmat = 0;
+   q->sorted = NULL;
+   QueueMaterial(q,1,0);
+   QueueDetail(q,0);
+   memcpy(q->view,view,sizeof(mat4));
+}
+
+/*
+ *  Material for the packets that follow
+ */
+void QueueMaterial(queue_t* q,float shiny,int emission)
+{
+   int k;
+   for (k=0;k<q->Nmat;k++)
+      if (q->matShiny[k]==shiny && q->matEmit[k]==emission)
+         break;
+   if (k==q->Nmat)
+   {
+      if (q->Nmat==MAXMAT) Fatal("More than %d materials in the render queue\n",MAXMAT);
+      q->matShiny[k] = shiny;
+      q->matEmit[k]  = emission;
+      q->Nmat++;
+   }
+   q->material = k;
+}
+
+/*
+ *  Tessellation step (degrees) of the spheres and cylinders that follow
+ *    0 is the default step of the shapes
+ */
+void QueueDetail(queue_t* q,int step)
+{
+   q->detail = step;
+}
+
+/*
+ *  Add a shape drawn with a model matrix, e.g. a world matrix from a
+ *  transform graph
+ *    numc and numt are the rings and segments of a half torus
+ */
+void QueueShape(queue_t* q,unsigned int texture,int shape,const mat4 model,int numc,int numt)
+{
+   packet_t* p;
+   float     x,y,z,h,depth;
+   unsigned int bits;
+   const float* V = q->view;
+   if (q->Npackets==q->Mpackets)
+   {
+      q->Mpackets = q->Mpackets ? 2*q->Mpackets : 256;
+      q->packets = (packet_t*)realloc(q->packets,q->Mpackets*sizeof(packet_t));
+      q->model = (mat4*)realloc(q->model,q->Mpackets*sizeof(mat4));
+      q->mv = (mat4*)realloc(q->mv,q->Mpackets*sizeof(mat4));
+      q->keys[0] = (entry_t*)realloc(q->keys[0],q->Mpackets*sizeof(entry_t));
+      q->keys[1] = (entry_t*)realloc(q->keys[1],q->Mpackets*sizeof(entry_t));
+      if (!q->packets || !q->model || !q->mv || !q->keys[0] || !q->keys[1]) Fatal("Cannot allocate %d render packets\n",q->Mpackets);
+   }
+   p = q->packets+q->Npackets;
+   p->shape = shape;
+   p->texture = texture;
+   p->material = q->material;
+   p->detail = q->detail;
+   p->numc = numc;
+   p->numt = numt;
+   memcpy(q->model[q->Npackets],model,sizeof(mat4));
+   //  Center of the shape (cylinders rise from their base)
+   h = shape==SHAPE_CYLINDER ? 0.5 : 0;
+   x = model[4]*h + model[12];
+   y = model[5]*h + model[13];
+   z = model[6]*h + model[14];
+   //  Distance in front of the eye (behind the eye sorts first)
+   depth = -(V[2]*x + V[6]*y + V[10]*z + V[14]);
+   if (!(depth>0)) depth = 0;
+   //  The bits of a positive float sort in the same order as its value
+   memcpy(&bits,&depth,sizeof(bits));
+   q->keys[0][q->Npackets].key = ((unsigned long long)(texture&0xFFFF)<<40) |
+                                 ((unsigned long long)(q->material&0xFFFF)<<24) |
+                                 (bits>>7);
+   q->keys[0][q->Npackets].packet = q->Npackets;
+   q->Npackets++;
+}
+
+/*
+ *  Draw calls and triangles of a packet, the way shapes.c draws it
+ */
+static int Triangles(const packet_t* p,int* draws)
+{
+   int d = p->detail>0 ? p->detail : 5;
+   switch (p->shape)
+   {
+      case SHAPE_CUBE:
+         *draws += 1;
+         return 12;
+      case SHAPE_TETRAHEDRON:
+         *draws += 1;
+         return 4;
+      //  Latitude bands of quads
+      case SHAPE_SPHERE:
+         *draws += 180/d;
+         return (180/d)*2*(360/d);
+      //  Two fans and a quad per side
+      case SHAPE_CYLINDER:
+         *draws += 2+360/d+1;
+         return 2*(360/d)+2*(360/d+1);
+      //  A quad strip per ring
+      case SHAPE_HALFTORUS:
+         *draws += p->numc;
+         return p->numc*2*(p->numt/2);
+   }
+   return 0;
+}
+
+/*
+ *  Sort the keys with a least significant digit radix sort on bytes
+ *    Bytes that are the same in every key are skipped
+ *    Returns the sorted array
+ */
+static entry_t* Sort(queue_t* q)
+{
+   int     k,b,n=q->Npackets;
+   entry_t *src=q->keys[0],*dst=q->keys[1],*tmp;
+   for (b=0;b<64;b+=8)
+   {
+      int count[256]={0},sum=0;
+      for (k=0;k<n;k++)
+         count[(src[k].key>>b)&0xFF]++;
+      if (count[(src[0].key>>b)&0xFF]==n) continue;
+      for (k=0;k<256;k++)
+      {
+         int c = count[k];
+         count[k] = sum;
+         sum += c;
+      }
+      for (k=0;k<n;k++)
+         dst[count[(src[k].key>>b)&0xFF]++] = src[k];
+      tmp = src; src = dst; dst = tmp;
+   }
+   return src;
+}
+
+/*
+ *  Finish a frame: work out the modelview matrixes and sort the packets
+ *    Called by QueueFlush if it has not been already
+ */
+void QueueEnd(queue_t* q)
+{
+   Trace("QueueEnd");
+   Mat4MultiplyN(q->mv,q->view,(const mat4*)q->model,q->Npackets);
+   q->sorted = q->Npackets ? Sort(q) : NULL;
+}
+
+/*
+ *  Draw the packets in key order
+ */
+void QueueFlush(queue_t* q)
+{
+   int k,tex=-1,mat=-1,detail=-1,draws=0,triangles=0;
+   entry_t* e;
+   Trace("QueueFlush");
+   if (!q->Npackets) return;
+   if (!q->sorted) QueueEnd(q);
+   e = q->sorted;
+   glPushMatrix();
+   for (k=0;k<q->Npackets;k++)
+   {
+      packet_t* p = q->packets + e[k].packet;
+      //  State changes between groups
+      if ((int)p->texture!=tex)
+      {
+         tex = p->texture;
+         glBindTexture(GL_TEXTURE_2D,tex);
+      }
+      if (p->material!=mat)
+      {
+         mat = p->material;
+         ShapeMaterial(q->matShiny[mat],q->matEmit[mat]);
+      }
+      if (p->detail!=detail)
+      {
+         detail = p->detail;
+         ShapeDetail(detail);
+      }
+      glLoadMatrixf(q->mv[e[k].packet]);
+      switch (p->shape)
+      {
+         case SHAPE_CUBE:        UnitCube();                     break;
+         case SHAPE_TETRAHEDRON: UnitTetrahedron();              break;
+         case SHAPE_SPHERE:      UnitSphere();                   break;
+         case SHAPE_CYLINDER:    UnitCylinder();                 break;
+         case SHAPE_HALFTORUS:   UnitHalfTorus(p->numc,p->numt); break;
+      }
+      triangles += Triangles(p,&draws);
+   }
+   glPopMatrix();
+   ShapeDetail(0);
+   PerfDraws(draws,triangles);
+   q->Npackets = 0;
+   q->sorted = NULL;
+}
@@ -0,0 +1,389 @@
+/*
+ *  Textured solids used to build the HW6 skyline
+ *
+ *  Every shape sets the shininess and emission given to ShapeMaterial
+ *  The Unit versions draw the shape in its own coordinates, for callers
+ *  that load the modelview matrix themselves
+ */
+#include "CSCIx229.h"
+
+static float Shiny=1;  //  Shininess (value)
+static int   Emit=0;   //  Emission intensity (%)
+static int   Step=5;   //  Sphere and cylinder tessellation (degrees)
+
+/*
+ *  Set the material used by the shapes
+ */
+void ShapeMaterial(float shiny,int emission)
+{
+   Shiny = shiny;
+   Emit  = emission;
+}
+
+/*
+ *  Set the tessellation step of spheres and cylinders
+ *     step must divide 180 degrees (0 for the default of 5)
+ */
+void ShapeDetail(int step)
+{
+   Step = step>0 ? step : 5;
+}
+
+/*
+ *  Draw vertex in polar coordinates
+ */
+static void Vertex(double th,double ph){
+   double x = Sin(th)*Cos(ph);
+   double y = Cos(th)*Cos(ph);
+   double z =         Sin(ph);
+   //  For a sphere at the origin, the position
+   //  and normal vectors are the same
+   glTexCoord2d(x, y);
+   glNormal3d(x,y,z);
+   glVertex3d(x,y,z);
+}
+
+/*
+ *  Draw a cube
+ *     at (x,y,z)
+ *     dimensions (dx,dy,dz)
+ *     rotated th about the y axis
+ */
+void Cube(double x,double y,double z,double dx,double dy,double dz,double th){
+   //  Save transformation
+   glPushMatrix();
+   //  Offset, scale and rotate
+   glTranslated(x,y,z);
+   glRotated(th,0,1,0);
+   glScaled(dx,dy,dz);
+   UnitCube();
+   //  Undo transofrmations
+   glPopMatrix();
+}
+
+/*
+ *  Draw a cube from -1 to 1 in the current modelview
+ */
+void UnitCube(void){
+   //  Set specular color to white
+   float white[] = {1,1,1,1};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
+   glColor3f(1, 1, 1);
+   //  Cube
+   glBegin(GL_QUADS);
+   //  Front
+   glNormal3f( 0, 0, 1);
+   glTexCoord2f(0,0);
+   glVertex3f(-1,-1, 1);
+   glTexCoord2f(1,0);
+   glVertex3f(+1,-1, 1);
+   glTexCoord2f(1,1);
+   glVertex3f(+1,+1, 1);
+   glTexCoord2f(0,1);
+   glVertex3f(-1,+1, 1);
+   //  Back
+   glNormal3f( 0, 0,-1);
+   glTexCoord2f(0,0);
+   glVertex3f(+1,-1,-1);
+   glTexCoord2f(1,0);
+   glVertex3f(-1,-1,-1);
+   glTexCoord2f(1,1);
+   glVertex3f(-1,+1,-1);
+   glTexCoord2f(0,1);
+   glVertex3f(+1,+1,-1);
+   //  Right
+   glNormal3f(+1, 0, 0);
+   glTexCoord2f(0,0);
+   glVertex3f(+1,-1,+1);
+   glTexCoord2f(1,0);
+   glVertex3f(+1,-1,-1);
+   glTexCoord2f(1,1);
+   glVertex3f(+1,+1,-1);
+   glTexCoord2f(0,1);
+   glVertex3f(+1,+1,+1);
+   //  Left
+   glNormal3f(-1, 0, 0);
+   glTexCoord2f(0,0);
+   glVertex3f(-1,-1,-1);
+   glTexCoord2f(1,0);
+   glVertex3f(-1,-1,+1);
+   glTexCoord2f(1,1);
+   glVertex3f(-1,+1,+1);
+   glTexCoord2f(0,1);
+   glVertex3f(-1,+1,-1);
+   //  Top
+   glNormal3f( 0,+1, 0);
+   glTexCoord2f(0,0);
+   glVertex3f(-1,+1,+1);
+   glTexCoord2f(1,0);
+   glVertex3f(+1,+1,+1);
+   glTexCoord2f(1,1);
+   glVertex3f(+1,+1,-1);
+   glTexCoord2f(0,1);
+   glVertex3f(-1,+1,-1);
+   //  Bottom
+   glNormal3f( 0,-1, 0);
+   glTexCoord2f(0,0);
+   glVertex3f(-1,-1,-1);
+   glTexCoord2f(1,0);
+   glVertex3f(+1,-1,-1);
+   glTexCoord2f(1,1);
+   glVertex3f(+1,-1,+1);
+   glTexCoord2f(0,1);
+   glVertex3f(-1,-1,+1);
+   //  End
+   glEnd();
+}
+
+/*
+ *  Draw a ball
+ *     at (x,y,z)
+ *     radius (r)
+ */
+void Ball(double x,double y,double z,double r,int inc)
+{
+   int th,ph;
+   float yellow[] = {1.0,1.0,0.0,1.0};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   //  Save transformation
+   glPushMatrix();
+   //  Offset, scale and rotate
+   glTranslated(x,y,z);
+   glScaled(r,r,r);
+   //  White ball
+   glColor3f(1,1,1);
+   glMaterialf(GL_FRONT,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT,GL_SPECULAR,yellow);
+   glMaterialfv(GL_FRONT,GL_EMISSION,Emission);
+   //  Bands of latitude
+   for (ph=-90;ph<90;ph+=inc)
+   {
+      glBegin(GL_QUAD_STRIP);
+      for (th=0;th<=360;th+=2*inc)
+      {
+         Vertex(th,ph);
+         Vertex(th,ph+inc);
+      }
+      glEnd();
+   }
+   //  Undo transofrmations
+   glPopMatrix();
+}
+
+/*
+ *  Draw a tetrahedron
+ *     at (x,y,z)
+ *     dimensions (dx,dy,dz)
+ */
+void Tetrahedron(double x,double y,double z,double dx,double dy,double dz){
+   //  Save transformation
+   glPushMatrix();
+   //  Offset
+   glTranslated(x,y,z);
+   glScaled(dx,dy,dz);  // Move left and into the screen
+   UnitTetrahedron();
+   //  Undo transformations
+   glPopMatrix();
+}
+
+/*
+ *  Draw a tetrahedron from -1 to 1 in the current modelview
+ */
+void UnitTetrahedron(void){
+   float white[] = {1,1,1,1};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
+   glColor3f(1, 1, 1);
+   glBegin(GL_TRIANGLES); // Begin drawing the pyramid with 4 triangles
+
+   // Front
+   glNormal3f(0, 0.5, 1);   
+   glTexCoord2d(0, 0);
+   glVertex3f(0.0f, 1.0f, 0.0f);
+   glTexCoord2d(1, 0);
+   glVertex3f(-1.0f, -1.0f, 1.0f);   
+   glTexCoord2d(0.5, 1); 
+   glVertex3f(1.0f, -1.0f, 1.0f);
+
+   // Right
+   glNormal3f(1, 0.5, 0);  
+   glTexCoord2d(0, 0);
+   glVertex3f(0.0f, 1.0f, 0.0f);   
+   glTexCoord2d(1, 0);  
+   glVertex3f(1.0f, -1.0f, 1.0f); 
+   glTexCoord2d(0.5, 1);  
+   glVertex3f(1.0f, -1.0f, -1.0f);
+
+   // Back
+   glNormal3f(0, 0.5, -1);   
+   glTexCoord2d(0, 0);
+   glVertex3f(0.0f, 1.0f, 0.0f);  
+   glTexCoord2d(1, 0);
+   glVertex3f(1.0f, -1.0f, -1.0f); 
+   glTexCoord2d(0.5, 1); 
+   glVertex3f(-1.0f, -1.0f, -1.0f);
+
+   // Left
+   glNormal3f(-1, 0.5, 0);    
+   glTexCoord2d(0, 0);   
+   glVertex3f( 0.0f, 1.0f, 0.0f);  
+   glTexCoord2d(1, 0);   
+   glVertex3f(-1.0f,-1.0f,-1.0f); 
+   glTexCoord2d(0.5, 1);   
+   glVertex3f(-1.0f,-1.0f, 1.0f);
+
+   glEnd();   
+}
+
+/*
+ *  Draw a textured sphere
+ *     at (x,y,z)
+ *     radius (r)
+ */
+void Sphere(double x,double y,double z,double r) {
+   //  Save transformation
+   glPushMatrix();
+   //  Offset and scale
+   glTranslated(x,y,z);
+   glScaled(r,r,r);
+   UnitSphere();
+   //  Undo transformations
+   glPopMatrix();
+}
+
+/*
+ *  Draw a sphere of radius 1 in the current modelview
+ */
+void UnitSphere(void) {
+   const int d=Step;
+   int th,ph;
+   float white[] = {1,1,1,1};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
+   glColor3f(1, 1, 1);
+
+   //  Latitude bands
+   for (ph=-90;ph<90;ph+=d)
+   {
+      glBegin(GL_QUAD_STRIP);
+      for (th=0;th<=360;th+=d)
+      {
+         Vertex(th,ph);
+         Vertex(th,ph+d);
+      }
+      glEnd();
+   }
+}
+
+/**
+ * Draws a cylinder
+ * */
+void Cylinder(double doubleX, double doubleY, double doubleZ, double radius, double height){
+  //  Save transformation
+  glPushMatrix();
+  //  Offset and scale
+  glTranslated(doubleX, doubleY, doubleZ);
+  glScalef(radius, height, radius);
+  UnitCylinder();
+  //  Undo transformations
+  glPopMatrix();
+}
+
+/**
+ * Draws a cylinder of radius 1 from y=0 to 1 in the current modelview
+ * */
+void UnitCylinder(void){
+   const int d=Step;
+   float white[] = {1,1,1,1};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
+   glColor3f(1, 1, 1);
+
+  glBegin(GL_TRIANGLE_FAN);
+  glVertex3f(0, 0, 0);
+  for (int th=0; th<=360; th+=d) {
+    glNormal3f(0, 1, 0);
+    glTexCoord2d(Sin(th), Cos(th));
+    glVertex3f(Sin(th), 0, Cos(th));
+  }
+  glEnd();
+
+  for (int th=0; th<=360; th+=d) {
+    glBegin(GL_QUADS);
+    glTexCoord2d(Cos(th), Sin(th));
+    glNormal3f(Cos(th), 0, Sin(th));
+    glVertex3f(Sin(th), 0, Cos(th));
+    glVertex3f(Sin(th), 1, Cos(th));
+    glVertex3f(Sin(th+d), 1, Cos(th+d));
+    glVertex3f(Sin(th+d), 0, Cos(th+d));
+    glEnd();
+  }
+
+  glBegin(GL_TRIANGLE_FAN);
+  glVertex3f(0, 1, 0);
+  for (int th=0; th<=360; th+=d) {
+    glNormal3f(0, -1, 0);
+    glTexCoord2d(Sin(th), Cos(th));
+    glVertex3f(Sin(th), 1, Cos(th));
+  }
+  glEnd();
+}
+
+/**
+ * Draws a torus cut in half along the y axis; adapted code from https://www.opengl.org/archives/resources/code/samples/redbook/torus.c
+ * */
+void HalfTorus(double doubleX, double doubleY, double doubleZ, int numc, int numt, double r) {
+   glPushMatrix();
+   glTranslated(doubleX, doubleY, doubleZ);
+   glScaled(r,r,r);
+   UnitHalfTorus(numc,numt);
+   glPopMatrix();
+}
+
+/**
+ * Draws a half torus of radius 1 in the current modelview
+ * */
+void UnitHalfTorus(int numc, int numt) {
+   
+   float white[] = {1,1,1,1};
+   float Emission[]  = {0.0,0.0,0.01*Emit,1.0};
+   glMaterialf(GL_FRONT_AND_BACK,GL_SHININESS,Shiny);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emission);
+   
+   glColor3f(1,1,1);
+   int i, j, k;
+   double s, t, x, y, z, twopi;
+
+   twopi = 2 * PI;
+   for (i = 0; i < numc; i++) {
+      glBegin(GL_QUAD_STRIP);
+      for (j = 0; j <= numt / 2; j++) {
+         for (k = 1; k >= 0; k--) {
+            s = (i + k) % numc + 0.5;
+            t = j % numt;
+
+            x = (1+.2*cos(s*twopi/numc))*cos(t*twopi/numt);
+            y = (1+.4*cos(s*twopi/numc))*sin(t*twopi/numt);
+            z = .5 * sin(s * twopi / numc);
+
+            double textureX = (i + k) / (float) numc;
+            double textureY = t / (float) numt;
+
+            glTexCoord2d(textureX, textureY);
+            glNormal3f(x, y, z);
+            glVertex3f(x, y, z);
+         }
+      }
+      glEnd();
+   }
+}
@@ -0,0 +1,223 @@
+/*
+ *  Simulation thread with a lock-free triple buffer
+ *
+ *  SimStart runs a step function on its own thread at a fixed rate.  The
+ *  step publishes its results as a snapshot through a triple buffer: the
+ *  simulation fills one slot, the renderer draws from another and the
+ *  third holds the newest complete snapshot.  Publishing and picking up
+ *  the newest snapshot each swap one slot index with an atomic exchange,
+ *  so neither side ever waits for the other.  A slow frame only means
+ *  some snapshots are never drawn, and a slow step only means the same
+ *  snapshot is drawn again.
+ *
+ *  Key presses go the other way through a single producer, single
+ *  consumer ring, so the simulation applies them in order.
+ *
+ *  The step returns whether anything animates.  When nothing does and
+ *  no key is queued, the thread sleeps until InputPush wakes it, and
+ *  SimIdle tells the renderer that it can stop polling for snapshots.
+ *
+ *  The step is passed the time since SimStart from the monotonic clock,
+ *  since GLUT may only be called from the thread that runs glutMainLoop.
+ */
+#include "CSCIx229.h"
+#include <pthread.h>
+#include <time.h>
+
+#define FRESH 4               //  Middle slot holds an unread snapshot
+#define INPUT_EVENTS 256      //  Input ring size (power of two)
+
+//  Input event
+typedef struct
+{
+   int special;
+   int code;
+} input_t;
+
+static input_t  ring[INPUT_EVENTS];
+static unsigned head=0;       //  Next event written (producer)
+static unsigned tail=0;       //  Next event read (consumer)
+
+static pthread_t thread;
+static int       running=0;   //  Simulation thread running
+static int     (*stepFunc)(int ms)=NULL;
+static int       animating=1; //  Last step asked for another
+static unsigned  stepped=0;   //  Events applied by published steps
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  input = PTHREAD_COND_INITIALIZER;
+static long long period=0;    //  Step interval (ns)
+static long long start=0;     //  Time of SimStart (ns)
+
+/*
+ *  Set up a triple buffer with three snapshot slots
+ *    The reader starts on c, so fill it before the first TripleRead
+ */
+void TripleInit(triple_t* t,void* a,void* b,void* c)
+{
+   t->slot[0] = a;
+   t->slot[1] = b;
+   t->slot[2] = c;
+   t->write  = 0;
+   t->middle = 1;
+   t->read   = 2;
+}
+
+/*
+ *  Slot for the writer to fill
+ */
+void* TripleWrite(triple_t* t)
+{
+   return t->slot[t->write];
+}
+
+/*
+ *  Publish the filled slot and take the middle one to write next
+ */
+void TriplePublish(triple_t* t)
+{
+   int old = __atomic_exchange_n(&t->middle,t->write|FRESH,__ATOMIC_ACQ_REL);
+   t->write = old & ~FRESH;
+}
+
+/*
+ *  Newest published snapshot
+ *    It stays valid until the next TripleRead
+ */
+void* TripleRead(triple_t* t)
+{
+   if (__atomic_load_n(&t->middle,__ATOMIC_RELAXED) & FRESH)
+   {
+      int old = __atomic_exchange_n(&t->middle,t->read,__ATOMIC_ACQ_REL);
+      t->read = old & ~FRESH;
+   }
+   return t->slot[t->read];
+}
+
+/*
+ *  Queue a key press for the simulation
+ *    Returns 0 if the ring is full and the event was dropped
+ */
+int InputPush(int special,int code)
+{
+   unsigned h = head;
+   if (h-__atomic_load_n(&tail,__ATOMIC_ACQUIRE)==INPUT_EVENTS) return 0;
+   ring[h&(INPUT_EVENTS-1)].special = special;
+   ring[h&(INPUT_EVENTS-1)].code = code;
+   __atomic_store_n(&head,h+1,__ATOMIC_RELEASE);
+   //  Wake the simulation if it is waiting for input
+   pthread_mutex_lock(&mutex);
+   pthread_cond_signal(&input);
+   pthread_mutex_unlock(&mutex);
+   return 1;
+}
+
+/*
+ *  Take the oldest queued key press
+ *    Returns 0 if there is none
+ */
+int InputPop(int* special,int* code)
+{
+   unsigned t = tail;
+   if (t==__atomic_load_n(&head,__ATOMIC_ACQUIRE)) return 0;
+   *special = ring[t&(INPUT_EVENTS-1)].special;
+   *code = ring[t&(INPUT_EVENTS-1)].code;
+   __atomic_store_n(&tail,t+1,__ATOMIC_RELEASE);
+   return 1;
+}
+
+/*
+ *  Monotonic time in ns
+ */
+static long long Now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return 1000000000LL*ts.tv_sec + ts.tv_nsec;
+}
+
+/*
+ *  Step at a fixed rate until stopped, sleeping while nothing animates
+ */
+static void* Loop(void* arg)
+{
+   long long next = Now();
+   while (__atomic_load_n(&running,__ATOMIC_ACQUIRE))
+   {
+      long long wait;
+      int more = stepFunc((Now()-start)/1000000);
+      //  The step has published everything it took from the ring
+      __atomic_store_n(&animating,more,__ATOMIC_RELEASE);
+      __atomic_store_n(&stepped,tail,__ATOMIC_RELEASE);
+      //  Wait for a key press
+      if (!more)
+      {
+         pthread_mutex_lock(&mutex);
+         while (__atomic_load_n(&running,__ATOMIC_ACQUIRE) && tail==__atomic_load_n(&head,__ATOMIC_ACQUIRE))
+            pthread_cond_wait(&input,&mutex);
+         pthread_mutex_unlock(&mutex);
+         next = Now();
+         continue;
+      }
+      //  Steps that were missed are skipped rather than run in a burst
+      next += period;
+      wait = next - Now();
+      if (wait>0)
+      {
+         struct timespec ts = {wait/1000000000LL,wait%1000000000LL};
+         nanosleep(&ts,NULL);
+      }
+      else
+         next -= wait;
+   }
+   return NULL;
+}
+
+/*
+ *  Stop the simulation thread (also called at exit)
+ */
+void SimStop(void)
+{
+   if (!running) return;
+   __atomic_store_n(&running,0,__ATOMIC_RELEASE);
+   pthread_mutex_lock(&mutex);
+   pthread_cond_signal(&input);
+   pthread_mutex_unlock(&mutex);
+   //  Exiting from a step ends the thread with the process
+   if (!pthread_equal(pthread_self(),thread)) pthread_join(thread,NULL);
+}
+
+/*
+ *  Time passed to the step (ms since SimStart)
+ *    Before SimStart this is the GLUT time, so only call it from the
+ *    thread that runs GLUT
+ */
+int SimTime(void)
+{
+   return start ? (Now()-start)/1000000 : glutGet(GLUT_ELAPSED_TIME);
+}
+
+/*
+ *  Whether the simulation is asleep with every key press published
+ *    The renderer can stop polling until the next InputPush
+ */
+int SimIdle(void)
+{
+   return !__atomic_load_n(&animating,__ATOMIC_ACQUIRE) &&
+          __atomic_load_n(&stepped,__ATOMIC_ACQUIRE)==__atomic_load_n(&head,__ATOMIC_ACQUIRE);
+}
+
+/*
+ *  Run step hz times a second on the simulation thread
+ *    step is passed the ms since SimStart and returns nonzero while
+ *    anything animates; otherwise the thread waits for InputPush
+ */
+void SimStart(int (*step)(int ms),double hz)
+{
+   if (running) Fatal("Simulation already running\n");
+   stepFunc = step;
+   period = (long long)(1e9/hz);
+   start = Now();
+   running = 1;
+   if (pthread_create(&thread,NULL,Loop,NULL)) Fatal("Cannot start simulation thread\n");
+   atexit(SimStop);
+}
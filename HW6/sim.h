@@ -0,0 +1,36 @@
+/*
+ *  Simulation thread and triple buffer (see sim.c)
+ *
+ *  CSCIx229.h includes this for HW6.  HW1 builds the same sim.c and
+ *  includes only this header, after the GLUT one.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+   void* slot[3];   //  Snapshots
+   int   write;     //  Slot being written
+   int   middle;    //  Newest complete snapshot
+   int   read;      //  Slot being read
+} triple_t;
+void  TripleInit(triple_t* t,void* a,void* b,void* c);
+void* TripleWrite(triple_t* t);
+void  TriplePublish(triple_t* t);
+void* TripleRead(triple_t* t);
+int   InputPush(int special,int code);
+int   InputPop(int* special,int* code);
+void  SimStart(int (*step)(int ms),double hz);
+int   SimIdle(void);
+int   SimTime(void);
+void  SimStop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ *  Scene object store
+ *
+ *  Objects are kept as a structure of arrays: each field is its own
+ *  64 byte aligned array, so a pass over the scene only reads the fields
+ *  it needs and reads them in order.  StoreCull tests four bounding
+ *  spheres at a time against the view frustum with SSE and works out the
+ *  eye space depth of the ones it keeps, splitting large stores into
+ *  chunks on the job system.
+ *
+ *  The store makes no OpenGL calls.  Adding objects must not overlap a
+ *  pass over the store.
+ */
+#include "CSCIx229.h"
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SIMD
+#endif
+
+#define ALIGN 64     //  Array alignment (bytes)
+#define CHUNK 16384  //  Objects culled by one job (multiple of 4)
+
+/*
+ *  Move an array to a new aligned allocation
+ */
+static void* Aligned(void* old,size_t used,size_t size)
+{
+   void* p=NULL;
+#ifdef _WIN32
+   p = _aligned_malloc(size,ALIGN);
+#else
+   if (posix_memalign(&p,ALIGN,size)) p = NULL;
+#endif
+   if (!p) Fatal("Cannot allocate %lu bytes for the object store\n",(unsigned long)size);
+   if (old)
+   {
+      memcpy(p,old,used);
+#ifdef _WIN32
+      _aligned_free(old);
+#else
+      free(old);
+#endif
+   }
+   return p;
+}
+
+/*
+ *  Make room for n objects
+ */
+static void Grow(store_t* s,int n)
+{
+   int m = s->max ? s->max : 1024;
+   while (m<n) m *= 2;
+#define GROW(a) s->a = Aligned(s->a,s->n*sizeof(*s->a),m*sizeof(*s->a))
+   GROW(x);  GROW(y);  GROW(z);
+   GROW(sx); GROW(sy); GROW(sz);
+   GROW(cx); GROW(cy); GROW(cz); GROW(r);
+   GROW(shape);
+   GROW(texture);
+   GROW(flags);
+   GROW(node);
+   GROW(user);
+#undef GROW
+   s->max = m;
+}
+
+/*
+ *  Empty store
+ */
+void StoreInit(store_t* s)
+{
+   memset(s,0,sizeof(store_t));
+}
+
+/*
+ *  Add an object and work out its bounding sphere
+ *    (x,y,z) and (sx,sy,sz) are as passed to the shape in shapes.c
+ *    Returns the object
+ */
+int StoreAdd(store_t* s,int shape,unsigned int texture,float x,float y,float z,float sx,float sy,float sz)
+{
+   int k = s->n;
+   if (k==s->max) Grow(s,k+1);
+   s->x[k]  = x;  s->y[k]  = y;  s->z[k]  = z;
+   s->sx[k] = sx; s->sy[k] = sy; s->sz[k] = sz;
+   s->cx[k] = x;  s->cy[k] = y;  s->cz[k] = z;
+   //  Cubes and tetrahedrons span +/-(sx,sy,sz) whichever way they turn
+   if (shape==SHAPE_CUBE || shape==SHAPE_TETRAHEDRON)
+      s->r[k] = sqrt(sx*sx+sy*sy+sz*sz);
+   //  Cylinders rise from their base
+   else if (shape==SHAPE_CYLINDER)
+   {
+      s->cy[k] += sy/2;
+      s->r[k] = sqrt(sx*sx+sy*sy/4);
+   }
+   //  Half torus spans (1.2,1.4,0.5) times its radius
+   else if (shape==SHAPE_HALFTORUS)
+      s->r[k] = sx*sqrt(1.2*1.2+1.4*1.4+0.5*0.5);
+   else
+      s->r[k] = sx;
+   s->shape[k] = shape;
+   s->texture[k] = texture;
+   s->flags[k] = 0;
+   s->node[k] = -1;
+   s->user[k] = -1;
+   s->n++;
+   return k;
+}
+
+//  Culling pass
+typedef struct
+{
+   const store_t* s;
+   int            n;       //  Objects culled
+   const float*   plane;   //  6 planes
+   const float*   V;       //  View matrix
+   int*           index;
+   float*         depth;
+   int*           count;   //  Kept in each chunk
+} cull_t;
+
+/*
+ *  Cull objects i0 to i1 into index and depth from i0 on
+ *    Returns the number kept
+ */
+static int CullRange(const cull_t* c,int i0,int i1)
+{
+   const store_t* s = c->s;
+   const float*   p = c->plane;
+   const float*   V = c->V;
+   int i=i0,n=i0;
+#ifdef SIMD
+   //  Four objects at a time (chunks start on a multiple of four)
+   for (;i+4<=i1;i+=4)
+   {
+      int    k,mask;
+      float  d[4];
+      __m128 x  = _mm_load_ps(s->cx+i);
+      __m128 y  = _mm_load_ps(s->cy+i);
+      __m128 z  = _mm_load_ps(s->cz+i);
+      __m128 nr = _mm_sub_ps(_mm_setzero_ps(),_mm_load_ps(s->r+i));
+      __m128 in = _mm_cmpeq_ps(x,x);
+      for (k=0;k<6;k++,p+=4)
+      {
+         __m128 e = _mm_mul_ps(_mm_set1_ps(p[0]),x);
+         e = _mm_add_ps(e,_mm_mul_ps(_mm_set1_ps(p[1]),y));
+         e = _mm_add_ps(e,_mm_mul_ps(_mm_set1_ps(p[2]),z));
+         e = _mm_add_ps(e,_mm_set1_ps(p[3]));
+         //  Same test as SphereVisible: outside if below -r
+         in = _mm_and_ps(in,_mm_cmpnlt_ps(e,nr));
+      }
+      p = c->plane;
+      mask = _mm_movemask_ps(in);
+      if (!mask) continue;
+      //  Distance in front of the eye
+      __m128 e = _mm_mul_ps(_mm_set1_ps(V[2]),x);
+      e = _mm_add_ps(e,_mm_mul_ps(_mm_set1_ps(V[6]),y));
+      e = _mm_add_ps(e,_mm_mul_ps(_mm_set1_ps(V[10]),z));
+      e = _mm_add_ps(e,_mm_set1_ps(V[14]));
+      _mm_storeu_ps(d,_mm_sub_ps(_mm_setzero_ps(),e));
+      for (k=0;k<4;k++)
+         if (mask&(1<<k))
+         {
+            c->index[n] = i+k;
+            c->depth[n] = d[k];
+            n++;
+         }
+   }
+#endif
+   for (;i<i1;i++)
+   {
+      if (!SphereVisible((const vec4*)p,s->cx[i],s->cy[i],s->cz[i],s->r[i])) continue;
+      c->index[n] = i;
+      c->depth[n] = -(V[2]*s->cx[i] + V[6]*s->cy[i] + V[10]*s->cz[i] + V[14]);
+      n++;
+   }
+   return n-i0;
+}
+
+/*
+ *  Cull a slice of chunks
+ */
+static void CullChunks(int c0,int c1,void* arg)
+{
+   cull_t* c = (cull_t*)arg;
+   int k;
+   for (k=c0;k<c1;k++)
+   {
+      int i1 = (k+1)*CHUNK<c->n ? (k+1)*CHUNK : c->n;
+      c->count[k] = CullRange(c,k*CHUNK,i1);
+   }
+}
+
+/*
+ *  Objects 0 to n-1 with any part in the view frustum
+ *    index gets the objects in store order and depth their distance in
+ *    front of the eye; both need room for n objects
+ *    Returns the number of objects in view
+ */
+int StoreCull(const store_t* s,int n,const vec4 plane[6],const mat4 view,int* index,float* depth)
+{
+   int    k,chunks = (n+CHUNK-1)/CHUNK;
+   int    count[64];
+   cull_t c = {s,n,(const float*)plane,view,index,depth,count};
+   Trace("StoreCull");
+   if (chunks<=1)
+      return CullRange(&c,0,n);
+   c.count = chunks>64 ? (int*)malloc(chunks*sizeof(int)) : count;
+   if (!c.count) Fatal("Cannot allocate %d cull chunks\n",chunks);
+   JobFor(chunks,1,CullChunks,&c);
+   //  Close the gaps between chunks
+   n = c.count[0];
+   for (k=1;k<chunks;k++)
+   {
+      memmove(index+n,index+k*CHUNK,c.count[k]*sizeof(int));
+      memmove(depth+n,depth+k*CHUNK,c.count[k]*sizeof(float));
+      n += c.count[k];
+   }
+   if (c.count!=count) free(c.count);
+   return n;
+}
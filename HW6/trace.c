@@ -0,0 +1,127 @@
+/*
+ *  Scoped tracing profiler
+ *
+ *  Trace("name"); at the top of a block records the time spent until the
+ *  block exits.  Each thread writes complete events into its own ring
+ *  buffer, so recording takes no locks.  Buffers are linked into a list
+ *  with a compare and swap the first time a thread records an event.
+ *  TraceOpen(file) writes the last TRACE_EVENTS events of every thread
+ *  as Chrome trace JSON when the program exits; load the file in
+ *  chrome://tracing or ui.perfetto.dev.
+ *
+ *  Everything here is compiled out unless built with -DTRACE
+ *  (make TRACE=1), leaving Trace() as an empty statement.
+ */
+#include "CSCIx229.h"
+#ifdef TRACE
+#include <time.h>
+
+#define TRACE_EVENTS 65536  //  Events kept per thread (power of two)
+
+//  Complete event (begin time and duration)
+typedef struct
+{
+   const char* name;
+   long long   t0,dt;    //  ns
+} event_t;
+
+//  Per thread buffer
+typedef struct buffer_t
+{
+   event_t          ev[TRACE_EVENTS];
+   unsigned long    n;   //  Events written (wraps around the ring)
+   int              tid; //  Thread number
+   struct buffer_t* next;
+} buffer_t;
+
+static buffer_t* buffers=NULL;       //  All thread buffers
+static int       threads=0;          //  Threads seen
+static __thread buffer_t* mine=NULL; //  This thread's buffer
+static const char* tracefile=NULL;   //  Output file
+static long long start=0;            //  Time of TraceOpen
+
+/*
+ *  Monotonic time in ns
+ */
+long long TraceNow(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return 1000000000LL*ts.tv_sec + ts.tv_nsec;
+}
+
+/*
+ *  Buffer for the calling thread, created on first use
+ */
+static buffer_t* Buffer(void)
+{
+   buffer_t* b = (buffer_t*)calloc(1,sizeof(buffer_t));
+   if (!b) Fatal("Cannot allocate trace buffer\n");
+   b->tid = __atomic_add_fetch(&threads,1,__ATOMIC_RELAXED);
+   //  Push onto the list of buffers
+   b->next = __atomic_load_n(&buffers,__ATOMIC_RELAXED);
+   while (!__atomic_compare_exchange_n(&buffers,&b->next,b,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+   return mine = b;
+}
+
+/*
+ *  Record the zone when its scope exits
+ */
+void TraceZoneEnd(TraceZone* z)
+{
+   buffer_t* b = mine ? mine : Buffer();
+   event_t*  e = b->ev + (b->n & (TRACE_EVENTS-1));
+   e->name = z->name;
+   e->t0 = z->t0;
+   e->dt = TraceNow() - z->t0;
+   //  Publish the event to the exporter
+   __atomic_store_n(&b->n,b->n+1,__ATOMIC_RELEASE);
+}
+
+/*
+ *  Write the events as Chrome trace JSON
+ */
+static void TraceWrite(void)
+{
+   buffer_t* b;
+   int first=1;
+   FILE* f = fopen(tracefile,"w");
+   if (!f)
+   {
+      fprintf(stderr,"Cannot write trace %s\n",tracefile);
+      return;
+   }
+   fprintf(f,"{\"traceEvents\": [\n");
+   for (b=__atomic_load_n(&buffers,__ATOMIC_ACQUIRE);b;b=b->next)
+   {
+      unsigned long n = __atomic_load_n(&b->n,__ATOMIC_ACQUIRE);
+      unsigned long k = n>TRACE_EVENTS ? n-TRACE_EVENTS : 0;
+      fprintf(f,"%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+         first?"":",\n",b->tid,b->tid==1?"main":"thread",b->tid);
+      first = 0;
+      if (n>TRACE_EVENTS)
+         fprintf(stderr,"Trace thread %d: kept the last %d of %lu events\n",b->tid,TRACE_EVENTS,n);
+      for (;k<n;k++)
+      {
+         event_t* e = b->ev + (k & (TRACE_EVENTS-1));
+         //  Times are in microseconds
+         fprintf(f,",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+            e->name,b->tid,1e-3*(e->t0-start),1e-3*e->dt);
+      }
+   }
+   fprintf(f,"\n]}\n");
+   fclose(f);
+}
+
+/*
+ *  Write the trace to file at exit
+ */
+void TraceOpen(const char* file)
+{
+   if (!tracefile) atexit(TraceWrite);
+   tracefile = file;
+   start = TraceNow();
+   //  The calling thread is listed first
+   if (!mine) Buffer();
+}
+#endif